@@ -8,11 +8,49 @@
 #include <gtc/type_ptr.hpp>
 #include <iostream>
 #include <vector>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <string>
+#include <cstring>
+#include <cstddef>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <map>
+#include <functional>
+#include <queue>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <sys/stat.h>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <assimp/ProgressHandler.hpp>
 #include <tinyfiledialogs.h>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE_CULLING
+#endif
+
 const unsigned int VIEWPORT_WIDTH = 800, VIEWPORT_HEIGHT = 800;
 const unsigned int OBJECT_PROPERTIES_PANEL_WIDTH = 250, OBJECT_LIST_PANEL_WIDTH = 250;
 const unsigned int WINDOW_WIDTH = OBJECT_PROPERTIES_PANEL_WIDTH + OBJECT_LIST_PANEL_WIDTH + VIEWPORT_WIDTH;
@@ -30,19 +68,570 @@ glm::vec3 movementBoundsMax(50.0f, 50.0f, 50.0f);
 glm::vec3 cameraTarget(0.0f), cameraPos(0.0f, 0.0f, 5.0f), cameraUp(0.0f, 1.0f, 0.0f), cameraFront = glm::normalize(cameraTarget - cameraPos);
 float cameraYaw = -90.0f, cameraPitch = 0.0f;
 
-GLuint gridVAO, gridVBO, VAO, lightCubeVAO, lightCubeVBO;
+GLuint VAO, lightCubeVAO, lightCubeVBO, lightInstanceVBO;
+
+
+struct BVHNode {
+    glm::vec3 boundsMin, boundsMax;
+    unsigned int leftFirst; // Left child index for interior nodes, first entry in triIndices for leaves
+    unsigned int triCount;  // 0 for interior nodes
+
+    bool isLeaf() const { return triCount > 0; }
+};
+
+struct MeshBVH {
+    std::vector<BVHNode> nodes;
+    std::vector<unsigned int> triIndices;
+};
+
+struct CpuMesh {
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> indices;
+    MeshBVH bvh;
+};
+
+struct MeshBounds {
+    glm::vec3 boundsMin, boundsMax;
+    glm::vec3 sphereCenter;
+    float sphereRadius;
+    MeshBounds() : boundsMin(0.0f), boundsMax(0.0f), sphereCenter(0.0f), sphereRadius(0.0f) {}
+};
+
+MeshBounds computeMeshBounds(const std::vector<glm::vec3>& positions) {
+    MeshBounds bounds;
+    if (positions.empty()) return bounds;
+
+    bounds.boundsMin = bounds.boundsMax = positions[0];
+    for (const glm::vec3& p : positions) {
+        bounds.boundsMin = glm::min(bounds.boundsMin, p);
+        bounds.boundsMax = glm::max(bounds.boundsMax, p);
+    }
+
+    bounds.sphereCenter = (bounds.boundsMin + bounds.boundsMax) * 0.5f;
+    float radiusSquared = 0.0f;
+    for (const glm::vec3& p : positions) {
+        glm::vec3 offset = p - bounds.sphereCenter;
+        radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+    }
+    bounds.sphereRadius = std::sqrt(radiusSquared);
+    return bounds;
+}
+
+enum class VertexFormat : uint32_t {
+    FLOAT,   // vec3 position + vec3 normal, 24 bytes
+    COMPACT  // CompactVertex, 12 bytes
+};
+
+// Positions are unorm16 relative to the mesh AABB, normals are octahedral-encoded snorm16 pairs
+struct CompactVertex {
+    uint16_t position[4];
+    int16_t normal[2];
+};
+
+size_t vertexStride(VertexFormat format) {
+    return format == VertexFormat::COMPACT ? sizeof(CompactVertex) : 6 * sizeof(float);
+}
+
+// A contiguous range of the mesh's index buffer; all levels share one vertex buffer
+struct MeshLod {
+    unsigned int firstIndex, indexCount;
+    float error;
+    MeshLod(unsigned int first = 0, unsigned int count = 0, float geometricError = 0.0f) : firstIndex(first), indexCount(count), error(geometricError) {}
+};
+
+struct StreamedMesh;
+
+struct MeshAsset {
+    // The mesh buffer pool's VAO for this vertex format, 0 until the mesh has ranges in the pool
+    GLuint VAO;
+    // Byte offsets of the mesh's ranges in the pool's shared vertex and index buffers
+    size_t vertexOffset, indexOffset;
+    // Sort key for the draw list: the vertex format in the top bit, so meshes sharing a VAO stay together
+    uint32_t drawId;
+    int vertexCount, indexCount;
+    VertexFormat vertexFormat;
+    GLenum indexType;
+    size_t vertexBytes, indexBytes;
+    float acmrBefore, acmrAfter;
+    std::vector<MeshLod> lods;
+    // Maps stored positions back into mesh space; folded into each instance's model matrix
+    glm::mat4 positionDecode;
+    MeshBounds bounds;
+    std::shared_ptr<const CpuMesh> cpuMesh;
+    // Entry in the GPU-driven renderer's mesh table, valid while indirectRevision matches the table's revision
+    int indirectMesh;
+    uint64_t indirectRevision;
+    // Set for meshes imported from a .meshstream file; they own no buffers and are drawn by the chunk streamer
+    std::shared_ptr<StreamedMesh> streamed;
+    MeshAsset()
+        : VAO(0), vertexOffset(0), indexOffset(0), drawId(0), vertexCount(0), indexCount(0), vertexFormat(VertexFormat::FLOAT), indexType(GL_UNSIGNED_INT),
+        vertexBytes(0), indexBytes(0), acmrBefore(0.0f), acmrAfter(0.0f), positionDecode(1.0f), indirectMesh(-1), indirectRevision(0) {}
+
+    size_t gpuBytes() const { return vertexBytes + indexBytes; }
+    GLint baseVertex() const { return static_cast<GLint>(vertexOffset / vertexStride(vertexFormat)); }
+    size_t indexSize() const { return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int); }
+    size_t uncompressedBytes() const { return size_t(vertexCount) * 6 * sizeof(float) + indexBytes / indexSize() * sizeof(unsigned int); }
+};
+
+// Fixed set of threads that run one parallel loop at a time; the calling thread helps and blocks until it is done.
+// Loops started from several threads take turns, and a loop started from inside a loop body runs serially on
+// the thread that started it, so code that parallelizes its inner loops can itself be called in parallel
+class WorkerGroup {
+public:
+    WorkerGroup() : body(nullptr), bodyCount(0), next(0), generation(0), busy(0), stopping(false) {}
+
+    void start(unsigned int threadCount) {
+        stopping = false;
+        for (unsigned int i = 0; i < threadCount; ++i) {
+            threads.emplace_back(&WorkerGroup::workerLoop, this, generation);
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) thread.join();
+        threads.clear();
+    }
+
+    unsigned int threadCount() const { return static_cast<unsigned int>(threads.size()) + 1; }
+
+    void parallelFor(size_t count, const std::function<void(size_t)>& loopBody) {
+        if (threads.empty() || count < 2 || insideLoop()) {
+            for (size_t i = 0; i < count; ++i) loopBody(i);
+            return;
+        }
+
+        std::lock_guard<std::mutex> turn(loopMutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            body = &loopBody;
+            bodyCount = count;
+            next = 0;
+            busy = static_cast<unsigned int>(threads.size());
+            generation++;
+        }
+        wake.notify_all();
+        insideLoop() = true;
+        runIterations();
+        insideLoop() = false;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return busy == 0; });
+        body = nullptr;
+    }
+
+    // Cuts [0, count) into grain-sized ranges that threads claim one at a time as they finish, so uneven work balances out
+    void parallelForRange(size_t count, size_t grain, const std::function<void(size_t, size_t)>& rangeBody) {
+        size_t rangeCount = (count + grain - 1) / grain;
+        parallelFor(rangeCount, [&](size_t range) {
+            rangeBody(range * grain, std::min(count, (range + 1) * grain));
+        });
+    }
+
+private:
+    // Set while the current thread is running loop iterations of any group
+    static bool& insideLoop() {
+        static thread_local bool inside = false;
+        return inside;
+    }
+
+    void runIterations() {
+        for (size_t i = next++; i < bodyCount; i = next++) (*body)(i);
+    }
+
+    // Starts from the generation current at start(), so a group that was stopped and started again does not
+    // replay its last loop
+    void workerLoop(unsigned int seenGeneration) {
+        insideLoop() = true;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+                if (stopping) return;
+                seenGeneration = generation;
+            }
+            runIterations();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--busy == 0) done.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex mutex, loopMutex;
+    std::condition_variable wake, done;
+    const std::function<void(size_t)>* body;
+    size_t bodyCount;
+    std::atomic<size_t> next;
+    unsigned int generation, busy;
+    bool stopping;
+};
+
+WorkerGroup frameWorkers;
+// Used by the import threads for per-mesh conversion, so imports never hold up the frame loops
+WorkerGroup importWorkers;
+
+// Vertices or indices per task in the import conversion loops
+const size_t IMPORT_TASK_GRAIN = 16384;
+
+// Objects per task in the per-frame loops; a multiple of 4 so SIMD groups never straddle two tasks
+const size_t FRAME_TASK_GRAIN = 256;
+
+// Structure-of-arrays bounding spheres, padded to a multiple of 4 for the SIMD culling loop
+struct BoundsTable {
+    std::vector<float> centerX, centerY, centerZ, radius;
+    size_t count;
+
+    BoundsTable() : count(0) {}
+
+    void resize(size_t newCount) {
+        count = newCount;
+        size_t padded = (newCount + 3) & ~static_cast<size_t>(3);
+        centerX.assign(padded, 0.0f);
+        centerY.assign(padded, 0.0f);
+        centerZ.assign(padded, 0.0f);
+        radius.assign(padded, -1.0f);
+    }
+
+    void set(size_t i, const glm::vec4& sphere) {
+        centerX[i] = sphere.x;
+        centerY[i] = sphere.y;
+        centerZ[i] = sphere.z;
+        radius[i] = sphere.w;
+    }
+
+    glm::vec4 get(size_t i) const { return glm::vec4(centerX[i], centerY[i], centerZ[i], radius[i]); }
+
+    void push(const glm::vec4& sphere) {
+        if (count == centerX.size()) {
+            size_t padded = count + 4;
+            centerX.resize(padded, 0.0f);
+            centerY.resize(padded, 0.0f);
+            centerZ.resize(padded, 0.0f);
+            radius.resize(padded, -1.0f);
+        }
+        set(count++, sphere);
+    }
+
+    // Moves the last sphere into slot i and pads the freed slot
+    void swapRemove(size_t i) {
+        --count;
+        if (i != count) set(i, get(count));
+        set(count, glm::vec4(0.0f, 0.0f, 0.0f, -1.0f));
+    }
+};
+
+// Moves the last element into slot i; the order of the dense component arrays is not preserved
+template <typename T>
+void swapRemove(std::vector<T>& components, size_t i) {
+    if (i + 1 != components.size()) components[i] = std::move(components.back());
+    components.pop_back();
+}
+
+// Generational reference to an entity; once the entity is removed the handle never resolves again,
+// even after its slot is reused
+struct EntityHandle {
+    static const uint32_t INVALID_SLOT = 0xFFFFFFFFu;
+    uint32_t slot, generation;
+
+    EntityHandle() : slot(INVALID_SLOT), generation(0) {}
+    EntityHandle(uint32_t slot, uint32_t generation) : slot(slot), generation(generation) {}
+
+    bool operator==(const EntityHandle& other) const { return slot == other.slot && generation == other.generation; }
+    bool operator!=(const EntityHandle& other) const { return !(*this == other); }
+};
+
+// Maps stable handles to indices in densely packed component arrays. Removing an entity moves the
+// last dense entry into its place, so the owner must apply the same swap to each of its arrays
+class HandleTable {
+public:
+    HandleTable() : layoutVersion(0) {}
+
+    EntityHandle add() {
+        uint32_t slot;
+        if (freeSlots.empty()) {
+            slot = static_cast<uint32_t>(slots.size());
+            slots.push_back(Slot());
+        }
+        else {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        slots[slot].dense = static_cast<uint32_t>(denseToSlot.size());
+        denseToSlot.push_back(slot);
+        return EntityHandle(slot, slots[slot].generation);
+    }
+
+    // Returns the dense index the entity occupied; the entry that was last now lives there
+    bool remove(EntityHandle handle, uint32_t& index) {
+        if (!resolve(handle, index)) return false;
+
+        uint32_t last = static_cast<uint32_t>(denseToSlot.size() - 1);
+        if (index != last) {
+            denseToSlot[index] = denseToSlot[last];
+            slots[denseToSlot[index]].dense = index;
+        }
+        denseToSlot.pop_back();
+        slots[handle.slot].generation++;
+        freeSlots.push_back(handle.slot);
+        layoutVersion++;
+        return true;
+    }
+
+    bool resolve(EntityHandle handle, uint32_t& index) const {
+        if (handle.slot >= slots.size() || slots[handle.slot].generation != handle.generation) return false;
+        index = slots[handle.slot].dense;
+        return true;
+    }
+
+    EntityHandle handle(uint32_t index) const { return EntityHandle(denseToSlot[index], slots[denseToSlot[index]].generation); }
+    size_t size() const { return denseToSlot.size(); }
+
+    // Changes whenever an existing entity moves to a different dense index
+    uint64_t layoutVersion;
+
+private:
+    struct Slot {
+        uint32_t dense, generation;
+        Slot() : dense(0), generation(0) {}
+    };
+
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+    std::vector<uint32_t> denseToSlot;
+};
+
+// Stands in for "no object" wherever a dense object index is expected
+const uint32_t NO_OBJECT = 0xFFFFFFFFu;
+
+// Imported mesh instances and the group nodes above them, stored as parallel component arrays indexed by
+// dense index. An entity's local transform is its position, rotation and scale applied on top of the bind
+// transform from the model file. World matrices and bounds are derived by updateTransforms() and kept in
+// contiguous arrays so the culling, matrix and picking loops stream through them
+class ObjectStore {
+public:
+    std::vector<glm::vec3> positions, rotations, scales;
+    std::vector<std::shared_ptr<MeshAsset>> meshes;
+    std::vector<int> lodLevels;
+
+    ObjectStore() : hierarchyDirty(false), anyTransformDirty(false), epoch(0) {}
+
+    EntityHandle create(const std::shared_ptr<MeshAsset>& mesh, EntityHandle parent = EntityHandle(), const glm::mat4& bindTransform = glm::mat4(1.0f)) {
+        uint32_t parentIndex;
+        if (resolve(parent, parentIndex)) childCounts[parentIndex]++;
+        else parent = EntityHandle();
+
+        positions.push_back(glm::vec3(0.0f));
+        rotations.push_back(glm::vec3(0.0f));
+        scales.push_back(glm::vec3(1.0f));
+        meshes.push_back(mesh);
+        lodLevels.push_back(0);
+        parents.push_back(parent);
+        childCounts.push_back(0);
+        bindTransforms.push_back(bindTransform);
+        worldMatrices.push_back(glm::mat4(1.0f));
+        normalMatrices.push_back(glm::mat3(1.0f));
+        worldBounds.push(glm::vec4(0.0f, 0.0f, 0.0f, -1.0f));
+        transformDirty.push_back(1);
+        worldChanged.push_back(0);
+        revisions.push_back(0);
+        hierarchyDirty = true;
+        anyTransformDirty = true;
+        return handles.add();
+    }
+
+    // Removes the entity and everything below it; a leaf is a constant-time swap-remove
+    bool remove(EntityHandle handle) {
+        uint32_t index;
+        if (!resolve(handle, index)) return false;
+        if (childCounts[index] == 0) {
+            removeEntity(handle);
+            return true;
+        }
+
+        // Parents precede their children in level order, so one pass marks the whole subtree
+        updateLevels();
+        std::vector<unsigned char> inSubtree(size(), 0);
+        std::vector<EntityHandle> subtree;
+        for (uint32_t i : levelOrder) {
+            if (i == index || (parentIndices[i] != NO_OBJECT && inSubtree[parentIndices[i]])) {
+                inSubtree[i] = 1;
+                subtree.push_back(handles.handle(i));
+            }
+        }
+        for (auto it = subtree.rbegin(); it != subtree.rend(); ++it) removeEntity(*it);
+        return true;
+    }
+
+    bool resolve(EntityHandle handle, uint32_t& index) const { return handles.resolve(handle, index); }
+    bool contains(EntityHandle handle) const { uint32_t index; return handles.resolve(handle, index); }
+    EntityHandle handle(size_t index) const { return handles.handle(static_cast<uint32_t>(index)); }
+    EntityHandle parent(size_t index) const { return parents[index]; }
+    unsigned int childCount(size_t index) const { return childCounts[index]; }
+    size_t size() const { return handles.size(); }
+    bool empty() const { return handles.size() == 0; }
+    uint64_t layoutVersion() const { return handles.layoutVersion; }
+
+    // Must be called after the position, rotation or scale of an entity are changed
+    void markTransformDirty(size_t i) {
+        transformDirty[i] = 1;
+        anyTransformDirty = true;
+    }
+
+    // Changes whenever the world transform does, including when an ancestor moved
+    unsigned int revision(size_t i) const { return revisions[i]; }
+
+    // Changes whenever updateTransforms() had anything to do, so callers can skip scanning the revisions
+    uint64_t transformEpoch() const { return epoch; }
+
+    // Recomputes the world transforms of moved entities and of everything below them. Each depth level is a
+    // contiguous run of the level order whose entries only read their parents from the level above, so a
+    // level is updated in parallel and the next one starts once it is done
+    void updateTransforms() {
+        if (!anyTransformDirty) return;
+        updateLevels();
+
+        for (size_t level = 0; level + 1 < levelStarts.size(); ++level) {
+            size_t first = levelStarts[level];
+            frameWorkers.parallelForRange(levelStarts[level + 1] - first, FRAME_TASK_GRAIN, [&](size_t begin, size_t end) {
+                for (size_t k = first + begin; k < first + end; ++k) updateTransform(levelOrder[k]);
+            });
+        }
+        anyTransformDirty = false;
+        epoch++;
+    }
+
+    // The accessors below are only current after updateTransforms()
+    const glm::mat4& worldMatrix(size_t i) const { return worldMatrices[i]; }
+    const glm::mat3& normalMatrix(size_t i) const { return normalMatrices[i]; }
+
+    // xyz is the world-space centre, w the radius
+    glm::vec4 worldBoundingSphere(size_t i) const { return worldBounds.get(i); }
+    const BoundsTable& bounds() const { return worldBounds; }
+
+private:
+    void removeEntity(EntityHandle handle) {
+        uint32_t i, parentIndex;
+        if (!resolve(handle, i)) return;
+        if (resolve(parents[i], parentIndex)) childCounts[parentIndex]--;
+        handles.remove(handle, i);
+
+        swapRemove(positions, i);
+        swapRemove(rotations, i);
+        swapRemove(scales, i);
+        swapRemove(meshes, i);
+        swapRemove(lodLevels, i);
+        swapRemove(parents, i);
+        swapRemove(childCounts, i);
+        swapRemove(bindTransforms, i);
+        swapRemove(worldMatrices, i);
+        swapRemove(normalMatrices, i);
+        worldBounds.swapRemove(i);
+        swapRemove(transformDirty, i);
+        swapRemove(worldChanged, i);
+        swapRemove(revisions, i);
+        hierarchyDirty = true;
+    }
+
+    // Rebuilds the dense parent indices and sorts entities by depth with a counting sort
+    void updateLevels() {
+        if (!hierarchyDirty) return;
+        size_t count = size();
+
+        parentIndices.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t parentIndex;
+            parentIndices[i] = resolve(parents[i], parentIndex) ? parentIndex : NO_OBJECT;
+        }
+
+        const uint32_t UNKNOWN_DEPTH = 0xFFFFFFFFu;
+        depths.assign(count, UNKNOWN_DEPTH);
+        uint32_t maxDepth = 0;
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t node = static_cast<uint32_t>(i);
+            chain.clear();
+            while (node != NO_OBJECT && depths[node] == UNKNOWN_DEPTH) {
+                chain.push_back(node);
+                node = parentIndices[node];
+            }
+            uint32_t depth = node == NO_OBJECT ? 0 : depths[node] + 1;
+            for (auto it = chain.rbegin(); it != chain.rend(); ++it) depths[*it] = depth++;
+            maxDepth = std::max(maxDepth, depths[i]);
+        }
+
+        levelStarts.assign(maxDepth + 2, 0);
+        for (size_t i = 0; i < count; ++i) levelStarts[depths[i] + 1]++;
+        for (size_t level = 1; level < levelStarts.size(); ++level) levelStarts[level] += levelStarts[level - 1];
+        levelOrder.resize(count);
+        std::vector<size_t> cursor(levelStarts.begin(), levelStarts.end() - 1);
+        for (size_t i = 0; i < count; ++i) levelOrder[cursor[depths[i]]++] = static_cast<uint32_t>(i);
+
+        hierarchyDirty = false;
+    }
+
+    void updateTransform(uint32_t i) {
+        uint32_t parentIndex = parentIndices[i];
+        bool parentMoved = parentIndex != NO_OBJECT && worldChanged[parentIndex];
+        if (!transformDirty[i] && !parentMoved) {
+            worldChanged[i] = 0;
+            return;
+        }
+
+        glm::mat4 local = glm::translate(glm::mat4(1.0f), positions[i]);
+        local = glm::rotate(local, glm::radians(rotations[i].x), glm::vec3(1.0f, 0.0f, 0.0f));
+        local = glm::rotate(local, glm::radians(rotations[i].y), glm::vec3(0.0f, 1.0f, 0.0f));
+        local = glm::rotate(local, glm::radians(rotations[i].z), glm::vec3(0.0f, 0.0f, 1.0f));
+        local = glm::scale(local, scales[i]) * bindTransforms[i];
+        worldMatrices[i] = parentIndex != NO_OBJECT ? worldMatrices[parentIndex] * local : local;
+        normalMatrices[i] = glm::transpose(glm::inverse(glm::mat3(worldMatrices[i])));
+
+        if (meshes[i]) {
+            const glm::mat4& world = worldMatrices[i];
+            float maxScale = std::max(glm::length(glm::vec3(world[0])), std::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+            worldBounds.set(i, glm::vec4(glm::vec3(world * glm::vec4(meshes[i]->bounds.sphereCenter, 1.0f)), meshes[i]->bounds.sphereRadius * maxScale));
+        }
+        transformDirty[i] = 0;
+        worldChanged[i] = 1;
+        revisions[i]++;
+    }
+
+    HandleTable handles;
+    std::vector<EntityHandle> parents;
+    std::vector<unsigned int> childCounts;
+    std::vector<glm::mat4> bindTransforms;
+    std::vector<glm::mat4> worldMatrices;
+    std::vector<glm::mat3> normalMatrices;
+    BoundsTable worldBounds;
+    std::vector<unsigned char> transformDirty, worldChanged;
+    std::vector<unsigned int> revisions;
+
+    // Derived from parents whenever the hierarchy changes
+    bool hierarchyDirty, anyTransformDirty;
+    uint64_t epoch;
+    std::vector<uint32_t> parentIndices, depths, chain, levelOrder;
+    std::vector<size_t> levelStarts;
+};
 
-std::vector<float> gridVertices;
+ObjectStore sceneObjects;
+// One node of a model's transform hierarchy. Nodes are stored breadth-first, so a parent always comes
+// before its children; both indices are -1 when absent
+struct ModelNode {
+    int32_t parent;
+    int32_t mesh;
+    glm::mat4 transform;
+};
 
-struct ImportedObject {
-    GLuint VAO, VBO, EBO;
-    int indexCount;
-    glm::vec3 position, rotation, scale;
-    ImportedObject()
-        : position(0.0f), rotation(0.0f), scale(1.0f), VAO(0), VBO(0), EBO(0), indexCount(0) {}
+struct LoadedModel {
+    std::vector<std::shared_ptr<MeshAsset>> meshes;
+    std::vector<ModelNode> nodes;
 };
 
-std::vector<ImportedObject> importedObjects;
+std::map<std::string, LoadedModel> loadedModels;
 
 struct SelectedObject {
     enum Type {
@@ -51,17 +640,36 @@ struct SelectedObject {
         LIGHT
     } type;
 
-    int index;
+    EntityHandle handle;
+    // Further imported objects picked together with the primary one, e.g. by a marquee; outlined but not edited
+    std::vector<EntityHandle> group;
+
+    SelectedObject() : type(NONE) {}
+
+    void select(Type newType, EntityHandle newHandle) {
+        type = newType;
+        handle = newHandle;
+        group.clear();
+    }
+
+    void add(EntityHandle object) {
+        if (contains(object)) return;
+        group.push_back(object);
+    }
 
-    SelectedObject() : type(NONE), index(-1) {}
+    bool contains(EntityHandle object) const {
+        if (type == IMPORTED_OBJECT && handle == object) return true;
+        return std::find(group.begin(), group.end(), object) != group.end();
+    }
 
     void clear() {
         type = NONE;
-        index = -1;
+        handle = EntityHandle();
+        group.clear();
     }
 
     bool isSelected() const {
-        return type != NONE && index >= 0;
+        return type != NONE && handle.slot != EntityHandle::INVALID_SLOT;
     }
 };
 
@@ -74,6 +682,7 @@ struct Light {
     float brightness;
     float cutOff;
     float outerCutOff;
+    bool castsShadows;
 
     Light(glm::vec3 pos = glm::vec3(0.0f, 5.0f, 0.0f),
         glm::vec3 dir = glm::vec3(0.0f, -1.0f, 0.0f),
@@ -81,18 +690,181 @@ struct Light {
         float bright = 3.0f,
         float cut = 20.0f,
         float outer = 25.0f)
-        : position(pos), direction(dir), color(col), brightness(bright), cutOff(cut), outerCutOff(outer) {}
+        : position(pos), direction(dir), color(col), brightness(bright), cutOff(cut), outerCutOff(outer), castsShadows(true) {}
+};
+
+// Spotlights packed by dense index; the light parameters form a single component since every
+// consumer reads all of them together
+class LightStore {
+public:
+    EntityHandle create(const Light& light = Light()) {
+        lights.push_back(light);
+        return handles.add();
+    }
+
+    bool remove(EntityHandle handle) {
+        uint32_t i;
+        if (!handles.remove(handle, i)) return false;
+        swapRemove(lights, i);
+        return true;
+    }
+
+    bool resolve(EntityHandle handle, uint32_t& index) const { return handles.resolve(handle, index); }
+    EntityHandle handle(size_t index) const { return handles.handle(static_cast<uint32_t>(index)); }
+    size_t size() const { return lights.size(); }
+    uint64_t layoutVersion() const { return handles.layoutVersion; }
+
+    Light& operator[](size_t i) { return lights[i]; }
+    const Light& operator[](size_t i) const { return lights[i]; }
+
+private:
+    HandleTable handles;
+    std::vector<Light> lights;
+};
+
+LightStore sceneLights;
+bool sceneLightsDirty = true;
+
+const GLuint CAMERA_BLOCK_BINDING = 0, LIGHT_BLOCK_BINDING = 1;
+
+// Mirrors the std140 layouts of CameraBlock and LightBlock in the shaders
+struct CameraBlockData {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 viewPosition;
+};
+
+struct LightBlockData {
+    glm::uvec4 clusterDimensions; // Tiles in x and y, depth slices, total light count
+    glm::vec4 clusterParams;      // Tile width and height in pixels, depth slice scale and bias
+};
+
+// Four texels per light in the light data buffer texture; attenuation.w is the range used for clustering
+struct GpuLight {
+    glm::vec4 positionBrightness;
+    glm::vec4 directionCutOff;
+    glm::vec4 colorOuterCutOff;
+    glm::vec4 attenuation;
+};
+
+std::vector<GpuLight> gpuLights;
+
+const glm::vec3 LIGHT_ATTENUATION(1.0f, 0.09f, 0.032f);
+// Contribution below which a light is treated as out of range
+const float LIGHT_INFLUENCE_THRESHOLD = 0.02f;
+
+// Distance at which brightness / (constant + linear * d + quadratic * d^2) drops to the influence threshold
+float computeLightRange(const Light& light) {
+    float peak = light.brightness * std::max(light.color.x, std::max(light.color.y, light.color.z));
+    float target = peak / LIGHT_INFLUENCE_THRESHOLD - LIGHT_ATTENUATION.x;
+    if (target <= 0.0f) return 0.0f;
+    float a = LIGHT_ATTENUATION.z, b = LIGHT_ATTENUATION.y;
+    return (-b + std::sqrt(b * b + 4.0f * a * target)) / (2.0f * a);
+}
+
+GLuint cameraUBO, lightUBO;
+
+enum class Uniform {
+    OBJECT_COLOR,
+    OUTLINE_COLOR,
+    MAIN_LINE_COLOR,
+    SECONDARY_LINE_COLOR,
+    SCENE_COLOR,
+    SELECTION_MASK,
+    OCTAHEDRAL_NORMALS,
+    LIGHT_DATA,
+    CLUSTER_GRID,
+    CLUSTER_LIGHT_INDICES,
+    BOX_TRANSFORM,
+    SHADOW_ATLAS,
+    SHADOW_DATA,
+    LIGHT_VIEW_PROJECTION,
+    FRUSTUM_PLANES,
+    EYE_POSITION,
+    PIXELS_PER_UNIT,
+    LOD_PIXEL_ERROR,
+    LOD_HYSTERESIS,
+    SLOT_COUNT,
+    COUNT
 };
 
-std::vector<Light> sceneLights;
+const char* const UNIFORM_NAMES[] = {
+    "objectColor",
+    "outlineColor",
+    "mainLineColor",
+    "secondaryLineColor",
+    "sceneColor",
+    "selectionMask",
+    "octahedralNormals",
+    "lightData",
+    "clusterGrid",
+    "clusterLightIndices",
+    "boxTransform",
+    "shadowAtlas",
+    "shadowData",
+    "lightViewProjection",
+    "frustumPlanes",
+    "eyePosition",
+    "pixelsPerUnit",
+    "lodPixelError",
+    "lodHysteresis",
+    "slotCount"
+};
+
+struct ShaderProgram {
+    GLuint id;
+    GLint locations[static_cast<int>(Uniform::COUNT)];
+
+    ShaderProgram() : id(0) {
+        std::fill(std::begin(locations), std::end(locations), -1);
+    }
+
+    GLint location(Uniform uniform) const {
+        return locations[static_cast<int>(uniform)];
+    }
+};
+
+// Set once the context is up; GL 4.3 brings the compute shaders, storage buffers and multi-draw indirect
+// that the GPU-driven object path needs
+bool gpuDrivenSupported = false;
+
+GLFWwindow* createContextWindow(bool headless) {
+    GLFWwindow* window = nullptr;
+#if !defined(_WIN32) && defined(GLFW_PLATFORM_NULL)
+    if (headless) {
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+        window = glfwCreateWindow(VIEWPORT_WIDTH, VIEWPORT_HEIGHT, "Headless", nullptr, nullptr);
+        if (!window) {
+            glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+            window = glfwCreateWindow(VIEWPORT_WIDTH, VIEWPORT_HEIGHT, "Headless", nullptr, nullptr);
+        }
+    }
+#endif
+    if (!window) {
+        window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Computer Graphics Assignment 2", nullptr, nullptr);
+    }
+    return window;
+}
 
-GLFWwindow* initGLFW() {
+// Headless runs get an invisible context with no display attached: GLFW's null platform with an
+// EGL (or OSMesa) context where available, which works on Mesa llvmpipe, and a hidden window elsewhere.
+// A 4.3 context is tried first; everything except the GPU-driven path only needs 3.3
+GLFWwindow* initGLFW(bool headless) {
+#if !defined(_WIN32) && defined(GLFW_PLATFORM_NULL)
+    if (headless) glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
     if (!glfwInit()) return nullptr;
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-
-    GLFWwindow* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Computer Graphics Assignment 2", nullptr, nullptr);
+    if (headless) glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+    const int contextVersions[][2] = { { 4, 3 }, { 3, 3 } };
+    GLFWwindow* window = nullptr;
+    for (const auto& version : contextVersions) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, version[0]);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, version[1]);
+        window = createContextWindow(headless);
+        if (window) break;
+    }
     if (!window) {
         std::cerr << "Failed to create GLFW window!" << std::endl;
         glfwTerminate();
@@ -100,7 +872,22 @@ GLFWwindow* initGLFW() {
     }
     glfwMakeContextCurrent(window);
     glewExperimental = GL_TRUE;
-    if (glewInit() != GLEW_OK) return nullptr;
+    GLenum glewStatus = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // GLX-built GLEW still loads the core entry points for an EGL context, it only fails to find a GLX display
+    if (headless && glewStatus == GLEW_ERROR_NO_GLX_DISPLAY) glewStatus = GLEW_OK;
+#endif
+    if (glewStatus != GLEW_OK) return nullptr;
+
+    GLint majorVersion = 0, minorVersion = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &majorVersion);
+    glGetIntegerv(GL_MINOR_VERSION, &minorVersion);
+    gpuDrivenSupported = majorVersion > 4 || (majorVersion == 4 && minorVersion >= 3);
+
+    if (headless) {
+        glfwSwapInterval(0);
+        return window;
+    }
 
     const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
     glfwSetWindowPos(window, (mode->width - 1300) / 2, (mode->height - 800) / 2);
@@ -150,133 +937,794 @@ glm::vec3 getRayFromScreenCoords(double mouseX, double mouseY, int screenWidth,
     return glm::normalize(rayWorld);
 }
 
-class Renderer {
-public:
-    void render(const std::vector<ImportedObject>& objects, GLuint shaderProgram, const glm::mat4& view, const glm::mat4& projection) {
-        glUseProgram(shaderProgram);
+struct Frustum {
+    glm::vec4 planes[6]; // Normalized, pointing inwards
+};
 
-        for (const auto& obj : objects) {
-            if (obj.indexCount == 0) continue;
+Frustum extractFrustum(const glm::mat4& viewProjection) {
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; ++i) {
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    }
 
-            glm::mat4 model = glm::translate(glm::mat4(1.0f), obj.position);
-            model = glm::rotate(model, glm::radians(obj.rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-            model = glm::rotate(model, glm::radians(obj.rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-            model = glm::rotate(model, glm::radians(obj.rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-            model = glm::scale(model, obj.scale);
+    Frustum frustum;
+    frustum.planes[0] = rows[3] + rows[0]; // Left
+    frustum.planes[1] = rows[3] - rows[0]; // Right
+    frustum.planes[2] = rows[3] + rows[1]; // Bottom
+    frustum.planes[3] = rows[3] - rows[1]; // Top
+    frustum.planes[4] = rows[3] + rows[2]; // Near
+    frustum.planes[5] = rows[3] - rows[2]; // Far
+    for (auto& plane : frustum.planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    return frustum;
+}
 
-            glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-            glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-            glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+bool sphereInFrustum(const Frustum& frustum, const glm::vec3& center, float radius) {
+    for (const auto& plane : frustum.planes) {
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) return false;
+    }
+    return true;
+}
 
-            glBindVertexArray(obj.VAO);
-            glDrawElements(GL_TRIANGLES, obj.indexCount, GL_UNSIGNED_INT, nullptr);
+// Tests the spheres in [begin, end); begin and end must be multiples of 4 or the padded table size
+void cullBoundingSphereRange(const Frustum& frustum, const BoundsTable& table, std::vector<unsigned char>& visible, size_t begin, size_t end) {
+#ifdef USE_SSE_CULLING
+    for (size_t i = begin; i < end; i += 4) {
+        __m128 cx = _mm_loadu_ps(&table.centerX[i]);
+        __m128 cy = _mm_loadu_ps(&table.centerY[i]);
+        __m128 cz = _mm_loadu_ps(&table.centerZ[i]);
+        __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&table.radius[i]));
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+        for (const auto& plane : frustum.planes) {
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+                _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
         }
 
-        glBindVertexArray(0);
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; lane < 4; ++lane) {
+            visible[i + lane] = static_cast<unsigned char>((mask >> lane) & 1);
+        }
     }
-};
+#else
+    for (size_t i = begin; i < end; ++i) {
+        bool inside = true;
+        for (const auto& plane : frustum.planes) {
+            float distance = plane.x * table.centerX[i] + plane.y * table.centerY[i] + plane.z * table.centerZ[i] + plane.w;
+            inside = inside && distance >= -table.radius[i];
+        }
+        visible[i] = inside ? 1 : 0;
+    }
+#endif
+}
 
-bool intersectRayTriangle(const glm::vec3& rayOrigin, const glm::vec3& rayDir,
-    const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, float& t) {
-    const float EPSILON = 1e-8f;
-    glm::vec3 edge1 = v1 - v0;
-    glm::vec3 edge2 = v2 - v0;
-    glm::vec3 h = glm::cross(rayDir, edge2);
-    float a = glm::dot(edge1, h);
+void cullBoundingSpheres(const Frustum& frustum, const BoundsTable& table, std::vector<unsigned char>& visible) {
+    visible.resize(table.centerX.size());
+    frameWorkers.parallelForRange(table.centerX.size(), FRAME_TASK_GRAIN, [&](size_t begin, size_t end) {
+        cullBoundingSphereRange(frustum, table, visible, begin, end);
+    });
+}
 
-    if (a > -EPSILON && a < EPSILON) return false;
+struct FrameStats {
+    unsigned int drawCalls;
+    unsigned long long triangles;
+    size_t occludedObjects;
+    unsigned long long fragmentsShaded;
+    unsigned int shadowMapsRendered;
+    // Program and vertex array binds in the draw paths
+    unsigned int stateChanges;
+    // Bytes copied from the CPU into GL buffers
+    unsigned long long bytesUploaded;
+
+    FrameStats() : drawCalls(0), triangles(0), occludedObjects(0), fragmentsShaded(0), shadowMapsRendered(0), stateChanges(0), bytesUploaded(0) {}
+};
 
-    float f = 1.0f / a;
-    glm::vec3 s = rayOrigin - v0;
-    float u = f * glm::dot(s, h);
+FrameStats frameStats;
 
-    if (u < 0.0f || u > 1.0f) return false;
+const GLuint INSTANCE_MODEL_LOCATION = 2, INSTANCE_NORMAL_MATRIX_LOCATION = 6, INSTANCE_PICK_ID_LOCATION = 9;
 
-    glm::vec3 q = glm::cross(s, edge1);
-    float v = f * glm::dot(rayDir, q);
+// Values written to the scene's ID attachment: 0 is background, objects store their dense index + 1 and lights
+// additionally set the top bit
+const GLuint PICK_ID_NONE = 0, PICK_ID_LIGHT_BIT = 0x80000000u;
 
-    if (v < 0.0f || u + v > 1.0f) return false;
+struct InstanceData {
+    glm::mat4 model;
+    glm::mat3 normalMatrix;
+    GLuint pickId;
+};
 
-    t = f * glm::dot(edge2, q);
-    return t > EPSILON;
+void bindInstanceAttributes(GLuint instanceBuffer, size_t byteOffset) {
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    for (GLuint column = 0; column < 4; ++column) {
+        GLuint location = INSTANCE_MODEL_LOCATION + column;
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(byteOffset + offsetof(InstanceData, model) + column * sizeof(glm::vec4)));
+        glEnableVertexAttribArray(location);
+        glVertexAttribDivisor(location, 1);
+    }
+    for (GLuint column = 0; column < 3; ++column) {
+        GLuint location = INSTANCE_NORMAL_MATRIX_LOCATION + column;
+        glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(byteOffset + offsetof(InstanceData, normalMatrix) + column * sizeof(glm::vec3)));
+        glEnableVertexAttribArray(location);
+        glVertexAttribDivisor(location, 1);
+    }
+    glVertexAttribIPointer(INSTANCE_PICK_ID_LOCATION, 1, GL_UNSIGNED_INT, sizeof(InstanceData), (void*)(byteOffset + offsetof(InstanceData, pickId)));
+    glEnableVertexAttribArray(INSTANCE_PICK_ID_LOCATION);
+    glVertexAttribDivisor(INSTANCE_PICK_ID_LOCATION, 1);
 }
 
-void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
-    ImGuiIO& io = ImGui::GetIO();
-    io.AddMouseButtonEvent(button, action == GLFW_PRESS);
+// One entry of the frame's draw list. Every object uses the same lit shader, so the key starts at the mesh's draw
+// id (whose top bit keeps meshes sharing a pool VAO together), then the LOD level, then a logarithmic distance so
+// each instanced group is drawn front to back.
+struct DrawItem {
+    uint64_t key;
+    uint32_t object;
+};
 
-    if (io.WantCaptureMouse) return;
+const unsigned int DRAW_KEY_DEPTH_BITS = 24;
+// Draw lists shorter than this are sorted on the calling thread
+const size_t PARALLEL_SORT_THRESHOLD = 4096;
 
-    if (action == GLFW_PRESS) {
-        if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS && button == GLFW_MOUSE_BUTTON_LEFT) {
-            isRolling = true;
-            glfwGetCursorPos(window, &lastMouseX, &lastMouseY);
-        }
-        else if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS && button == GLFW_MOUSE_BUTTON_LEFT) {
-            isTargetMoving = true;
-            glfwGetCursorPos(window, &lastMouseX, &lastMouseY);
-        }
-        else if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS && button == GLFW_MOUSE_BUTTON_RIGHT) {
-            isCameraMoving = true;
-            glfwGetCursorPos(window, &lastMouseX, &lastMouseY);
-        }
-        if (button == GLFW_MOUSE_BUTTON_LEFT) {
-            double mouseX, mouseY;
-            glfwGetCursorPos(window, &mouseX, &mouseY);
+uint64_t makeDrawKey(uint32_t object, const glm::vec3& eye) {
+    glm::vec4 sphere = sceneObjects.worldBoundingSphere(object);
+    float distance = std::max(glm::length(glm::vec3(sphere) - eye) - sphere.w, 0.0f);
+    // log2(1 + d) stays below 64 for any float distance, which leaves 18 bits of fraction
+    uint64_t depth = std::min(static_cast<uint64_t>(std::log2(1.0f + distance) * (1u << (DRAW_KEY_DEPTH_BITS - 6))), (uint64_t(1) << DRAW_KEY_DEPTH_BITS) - 1);
+    return (uint64_t(sceneObjects.meshes[object]->drawId) << 32) | (uint64_t(sceneObjects.lodLevels[object] & 0xFF) << DRAW_KEY_DEPTH_BITS) | depth;
+}
 
-            int screenWidth, screenHeight;
-            glfwGetFramebufferSize(window, &screenWidth, &screenHeight);
+// Objects in the same instanced draw share everything above the depth bits
+uint64_t drawBatchKey(uint64_t key) {
+    return key >> DRAW_KEY_DEPTH_BITS;
+}
 
-            glm::mat4 view = glm::lookAt(cameraPos, cameraTarget, cameraUp);
-            glm::vec3 rayOrigin = cameraPos;
-            glm::vec3 rayDirection = getRayFromScreenCoords(mouseX, mouseY, screenWidth, screenHeight, projection, view);
+// Sorts one chunk per thread, then merges neighbouring runs pairwise, each round in parallel
+void sortDrawList(std::vector<DrawItem>& items) {
+    auto byKey = [](const DrawItem& a, const DrawItem& b) { return a.key < b.key; };
+    size_t count = items.size();
+    size_t chunkCount = frameWorkers.threadCount();
+    if (count < PARALLEL_SORT_THRESHOLD || chunkCount < 2) {
+        std::sort(items.begin(), items.end(), byKey);
+        return;
+    }
 
-            int closestObjectIndex = -1;
-            float closestDistance = std::numeric_limits<float>::max();
+    size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+    frameWorkers.parallelFor(chunkCount, [&](size_t chunk) {
+        size_t begin = std::min(chunk * chunkSize, count), end = std::min(begin + chunkSize, count);
+        std::sort(items.begin() + begin, items.begin() + end, byKey);
+    });
+    for (size_t runSize = chunkSize; runSize < count; runSize *= 2) {
+        size_t pairCount = (count + 2 * runSize - 1) / (2 * runSize);
+        frameWorkers.parallelFor(pairCount, [&](size_t pair) {
+            size_t begin = pair * 2 * runSize;
+            size_t middle = std::min(begin + runSize, count), end = std::min(begin + 2 * runSize, count);
+            if (middle < end) std::inplace_merge(items.begin() + begin, items.begin() + middle, items.begin() + end, byKey);
+        });
+    }
+}
 
-            for (size_t i = 0; i < importedObjects.size(); ++i) {
-                const auto& obj = importedObjects[i];
-                float closestObjectT = std::numeric_limits<float>::max();
+// Turns the visible objects, given as dense indices into sceneObjects, into a sorted draw list and replays it on
+// the GL thread with one instanced call per mesh and LOD level. Key building, sorting and instance packing run on
+// the frame workers.
+class Renderer {
+public:
+    Renderer() : instanceVBO(0), instanceCapacity(0), batchedCount(0), octahedralNormalsSet(-1), boundVAO(0) {}
 
-                glBindVertexArray(obj.VAO);
-                glBindBuffer(GL_ARRAY_BUFFER, obj.VBO);
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj.EBO);
+    void render(const std::vector<uint32_t>& objects, const ShaderProgram& shaderProgram, const glm::vec3& eye) {
+        prepare(objects, eye);
+        draw(shaderProgram);
+    }
 
-                std::vector<float> vertices(obj.indexCount * 3);
-                std::vector<unsigned int> indices(obj.indexCount);
+    // Sorts the objects front to back from eye within each batch and uploads their instance data; draw() can then
+    // be called once per pass. highlighted holds sorted dense indices of the selected objects.
+    void prepare(const std::vector<uint32_t>& objects, const glm::vec3& eye, const std::vector<uint32_t>& highlighted = std::vector<uint32_t>()) {
+        drawList.clear();
+        highlightList.clear();
+        for (uint32_t obj : objects) {
+            const std::shared_ptr<MeshAsset>& mesh = sceneObjects.meshes[obj];
+            if (!mesh || mesh->indexCount == 0) continue;
+            if (std::binary_search(highlighted.begin(), highlighted.end(), obj)) highlightList.push_back(DrawItem{ makeDrawKey(obj, eye), obj });
+            else drawList.push_back(DrawItem{ 0, obj });
+        }
+        batchedCount = drawList.size();
+        if (drawList.empty() && highlightList.empty()) return;
+
+        frameWorkers.parallelForRange(drawList.size(), FRAME_TASK_GRAIN, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) drawList[i].key = makeDrawKey(drawList[i].object, eye);
+        });
+        sortDrawList(drawList);
+        std::sort(highlightList.begin(), highlightList.end(), [](const DrawItem& a, const DrawItem& b) { return a.key < b.key; });
+        drawList.insert(drawList.end(), highlightList.begin(), highlightList.end());
+
+        instances.resize(drawList.size());
+        frameWorkers.parallelForRange(drawList.size(), FRAME_TASK_GRAIN, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                uint32_t obj = drawList[i].object;
+                instances[i].model = sceneObjects.worldMatrix(obj) * sceneObjects.meshes[obj]->positionDecode;
+                instances[i].normalMatrix = sceneObjects.normalMatrix(obj);
+                instances[i].pickId = obj + 1;
+            }
+        });
+        uploadInstances();
+    }
 
-                glGetBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(float), vertices.data());
-                glGetBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indices.size() * sizeof(unsigned int), indices.data());
+    // The highlighted objects are drawn after the rest and are the only ones that write 1 into the stencil buffer
+    void draw(const ShaderProgram& shaderProgram) {
+        if (drawList.empty()) return;
+        glUseProgram(shaderProgram.id);
+        frameStats.stateChanges++;
+        octahedralNormalsSet = -1;
+        boundVAO = 0;
 
-                glm::mat4 modelMatrix = glm::translate(glm::mat4(1.0f), obj.position) *
-                    glm::rotate(glm::mat4(1.0f), glm::radians(obj.rotation.x), glm::vec3(1.0f, 0.0f, 0.0f)) *
-                    glm::rotate(glm::mat4(1.0f), glm::radians(obj.rotation.y), glm::vec3(0.0f, 1.0f, 0.0f)) *
-                    glm::rotate(glm::mat4(1.0f), glm::radians(obj.rotation.z), glm::vec3(0.0f, 0.0f, 1.0f)) *
-                    glm::scale(glm::mat4(1.0f), obj.scale);
+        drawBatches(shaderProgram, 0, batchedCount);
+        if (batchedCount < drawList.size()) {
+            glStencilFunc(GL_ALWAYS, 1, 0xFF);
+            glStencilMask(0xFF);
+            drawBatches(shaderProgram, batchedCount, drawList.size());
+            glStencilMask(0x00);
+        }
 
-                for (size_t j = 0; j < indices.size(); j += 3) {
-                    glm::vec3 v0 = glm::vec3(modelMatrix * glm::vec4(vertices[indices[j] * 3 + 0], vertices[indices[j] * 3 + 1], vertices[indices[j] * 3 + 2], 1.0f));
-                    glm::vec3 v1 = glm::vec3(modelMatrix * glm::vec4(vertices[indices[j + 1] * 3 + 0], vertices[indices[j + 1] * 3 + 1], vertices[indices[j + 1] * 3 + 2], 1.0f));
-                    glm::vec3 v2 = glm::vec3(modelMatrix * glm::vec4(vertices[indices[j + 2] * 3 + 0], vertices[indices[j + 2] * 3 + 1], vertices[indices[j + 2] * 3 + 2], 1.0f));
+        glBindVertexArray(0);
+    }
 
-                    float t;
-                    if (intersectRayTriangle(rayOrigin, rayDirection, v0, v1, v2, t)) {
-                        if (t < closestObjectT) {
-                            closestObjectT = t;
-                        }
-                    }
+private:
+    void drawBatches(const ShaderProgram& shaderProgram, size_t first, size_t end) {
+        while (first < end) {
+            uint64_t batch = drawBatchKey(drawList[first].key);
+            size_t last = first + 1;
+            while (last < end && drawBatchKey(drawList[last].key) == batch) ++last;
+
+            drawMesh(shaderProgram, drawList[first].object, first, last - first);
+            first = last;
+        }
+    }
+
+    void drawMesh(const ShaderProgram& shaderProgram, uint32_t object, size_t firstInstance, size_t instanceCount) {
+        const MeshAsset& mesh = *sceneObjects.meshes[object];
+        MeshLod lod = mesh.lods.empty() ? MeshLod(0, mesh.indexCount) : mesh.lods[std::min(sceneObjects.lodLevels[object], static_cast<int>(mesh.lods.size()) - 1)];
+
+        // Batches are sorted by vertex format first, so the pool VAO and the normal encoding rarely change between draws
+        int octahedralNormals = mesh.vertexFormat == VertexFormat::COMPACT ? 1 : 0;
+        if (octahedralNormals != octahedralNormalsSet) {
+            glUniform1i(shaderProgram.location(Uniform::OCTAHEDRAL_NORMALS), octahedralNormals);
+            octahedralNormalsSet = octahedralNormals;
+        }
+        if (mesh.VAO != boundVAO) {
+            glBindVertexArray(mesh.VAO);
+            boundVAO = mesh.VAO;
+            frameStats.stateChanges++;
+        }
+        bindInstanceAttributes(instanceVBO, firstInstance * sizeof(InstanceData));
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, lod.indexCount, mesh.indexType, (void*)(mesh.indexOffset + lod.firstIndex * mesh.indexSize()),
+            static_cast<GLsizei>(instanceCount), mesh.baseVertex());
+        frameStats.drawCalls++;
+        frameStats.triangles += static_cast<unsigned long long>(lod.indexCount / 3) * instanceCount;
+    }
+
+    void uploadInstances() {
+        if (!instanceVBO) glGenBuffers(1, &instanceVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+
+        size_t bytes = instances.size() * sizeof(InstanceData);
+        if (bytes > instanceCapacity) {
+            instanceCapacity = std::max(bytes, instanceCapacity * 2);
+        }
+        // Orphan the previous storage so the driver never waits on draws still reading it
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity, nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, instances.data());
+        frameStats.bytesUploaded += bytes;
+    }
+
+    GLuint instanceVBO;
+    size_t instanceCapacity;
+    std::vector<DrawItem> drawList, highlightList;
+    std::vector<InstanceData> instances;
+    size_t batchedCount;
+    int octahedralNormalsSet;
+    GLuint boundVAO;
+};
+
+// Hardware occlusion queries on each object's bounding box, tested against the finished depth buffer.
+// Results are read a frame late so the CPU never waits on the GPU; an object that comes out from behind
+// an occluder therefore appears one frame after it should.
+class OcclusionCuller {
+public:
+    OcclusionCuller() : boxVAO(0), boxVBO(0), boxEBO(0), slotLayoutVersion(0) {}
+
+    void setup() {
+        const float corners[] = {
+            -0.5f, -0.5f, -0.5f,   0.5f, -0.5f, -0.5f,   0.5f,  0.5f, -0.5f,  -0.5f,  0.5f, -0.5f,
+            -0.5f, -0.5f,  0.5f,   0.5f, -0.5f,  0.5f,   0.5f,  0.5f,  0.5f,  -0.5f,  0.5f,  0.5f
+        };
+        const GLubyte faces[] = {
+            0, 2, 1, 0, 3, 2,   4, 5, 6, 4, 6, 7,   0, 1, 5, 0, 5, 4,
+            3, 6, 2, 3, 7, 6,   0, 4, 7, 0, 7, 3,   1, 2, 6, 1, 6, 5
+        };
+
+        glGenVertexArrays(1, &boxVAO);
+        glGenBuffers(1, &boxVBO);
+        glGenBuffers(1, &boxEBO);
+        glBindVertexArray(boxVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faces), faces, GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glBindVertexArray(0);
+    }
+
+    // One query slot per dense object index; a changed object count or a removal, which moves objects
+    // to other indices, resets every slot to visible
+    void resize(size_t objectCount, uint64_t layoutVersion) {
+        if (objectCount == slots.size() && layoutVersion == slotLayoutVersion) return;
+        reset();
+        slots.resize(objectCount);
+        slotLayoutVersion = layoutVersion;
+        for (OcclusionSlot& slot : slots) glGenQueries(1, &slot.query);
+    }
+
+    void reset() {
+        for (OcclusionSlot& slot : slots) glDeleteQueries(1, &slot.query);
+        slots.clear();
+    }
+
+    // Uses the newest finished query for the object; objects the camera is inside of are never culled
+    bool isOccluded(size_t index) {
+        OcclusionSlot& slot = slots[index];
+        if (slot.pending) {
+            GLuint available = 0;
+            glGetQueryObjectuiv(slot.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint anySamples = 0;
+                glGetQueryObjectuiv(slot.query, GL_QUERY_RESULT, &anySamples);
+                slot.occluded = anySamples == 0;
+                slot.pending = false;
+            }
+        }
+
+        // The padded box reaches at most sqrt(3) * 1.02 radii from the centre, plus the near plane distance
+        glm::vec4 sphere = sceneObjects.worldBoundingSphere(index);
+        if (glm::length(glm::vec3(sphere) - cameraPos) < sphere.w * 1.8f + 0.1f) return false;
+        return slot.occluded;
+    }
+
+    // Draws the bounding box of every listed object without writing color or depth
+    void issueQueries(const ShaderProgram& shaderProgram, const std::vector<size_t>& indices) {
+        glUseProgram(shaderProgram.id);
+        glBindVertexArray(boxVAO);
+        frameStats.stateChanges += 2;
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glDepthFunc(GL_LEQUAL);
+
+        for (size_t index : indices) {
+            OcclusionSlot& slot = slots[index];
+            if (slot.pending) continue;
+
+            const MeshBounds& bounds = sceneObjects.meshes[index]->bounds;
+            glm::vec3 extent = glm::max((bounds.boundsMax - bounds.boundsMin) * 1.02f, glm::vec3(1e-3f));
+            glm::mat4 box = sceneObjects.worldMatrix(index) * glm::translate(glm::mat4(1.0f), (bounds.boundsMin + bounds.boundsMax) * 0.5f) * glm::scale(glm::mat4(1.0f), extent);
+            glUniformMatrix4fv(shaderProgram.location(Uniform::BOX_TRANSFORM), 1, GL_FALSE, glm::value_ptr(box));
+
+            glBeginQuery(GL_ANY_SAMPLES_PASSED, slot.query);
+            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, (void*)0);
+            glEndQuery(GL_ANY_SAMPLES_PASSED);
+            slot.pending = true;
+            frameStats.drawCalls++;
+        }
+
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glBindVertexArray(0);
+    }
+
+private:
+    struct OcclusionSlot {
+        GLuint query;
+        bool pending, occluded;
+        OcclusionSlot() : query(0), pending(false), occluded(false) {}
+    };
+
+    GLuint boxVAO, boxVBO, boxEBO;
+    std::vector<OcclusionSlot> slots;
+    uint64_t slotLayoutVersion;
+};
+
+OcclusionCuller occlusionCuller;
+
+// Samples that pass the depth test in the lit pass, i.e. fragments that run the lighting shader.
+// Alternates between two queries and reports the older one once it is ready.
+class FragmentCounter {
+public:
+    FragmentCounter() : frame(0), lastCount(0) { queries[0] = queries[1] = 0; }
+
+    void setup() { glGenQueries(2, queries); }
+
+    void begin() {
+        GLuint query = queries[frame % 2];
+        if (frame >= 2) {
+            GLuint available = 0;
+            glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint samples = 0;
+                glGetQueryObjectuiv(query, GL_QUERY_RESULT, &samples);
+                lastCount = samples;
+            }
+        }
+        glBeginQuery(GL_SAMPLES_PASSED, query);
+    }
+
+    void end() {
+        glEndQuery(GL_SAMPLES_PASSED);
+        ++frame;
+    }
+
+    unsigned long long count() const { return lastCount; }
+
+private:
+    GLuint queries[2];
+    unsigned long long frame, lastCount;
+};
+
+FragmentCounter fragmentCounter;
+
+bool intersectRayTriangle(const glm::vec3& rayOrigin, const glm::vec3& rayDir,
+    const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, float& t) {
+    const float EPSILON = 1e-8f;
+    glm::vec3 edge1 = v1 - v0;
+    glm::vec3 edge2 = v2 - v0;
+    glm::vec3 h = glm::cross(rayDir, edge2);
+    float a = glm::dot(edge1, h);
+
+    if (a > -EPSILON && a < EPSILON) return false;
+
+    float f = 1.0f / a;
+    glm::vec3 s = rayOrigin - v0;
+    float u = f * glm::dot(s, h);
+
+    if (u < 0.0f || u > 1.0f) return false;
+
+    glm::vec3 q = glm::cross(s, edge1);
+    float v = f * glm::dot(rayDir, q);
+
+    if (v < 0.0f || u + v > 1.0f) return false;
+
+    t = f * glm::dot(edge2, q);
+    return t > EPSILON;
+}
+
+float intersectRayBounds(const glm::vec3& rayOrigin, const glm::vec3& invRayDir, const glm::vec3& boxMin, const glm::vec3& boxMax, float tLimit) {
+    float tx1 = (boxMin.x - rayOrigin.x) * invRayDir.x, tx2 = (boxMax.x - rayOrigin.x) * invRayDir.x;
+    float tMin = std::min(tx1, tx2), tMax = std::max(tx1, tx2);
+    float ty1 = (boxMin.y - rayOrigin.y) * invRayDir.y, ty2 = (boxMax.y - rayOrigin.y) * invRayDir.y;
+    tMin = std::max(tMin, std::min(ty1, ty2)); tMax = std::min(tMax, std::max(ty1, ty2));
+    float tz1 = (boxMin.z - rayOrigin.z) * invRayDir.z, tz2 = (boxMax.z - rayOrigin.z) * invRayDir.z;
+    tMin = std::max(tMin, std::min(tz1, tz2)); tMax = std::min(tMax, std::max(tz1, tz2));
+
+    if (tMax >= tMin && tMin < tLimit && tMax > 0.0f) return tMin;
+    return std::numeric_limits<float>::max();
+}
+
+bool intersectRayMesh(const CpuMesh& mesh, const glm::vec3& rayOrigin, const glm::vec3& rayDir, float& t) {
+    const MeshBVH& bvh = mesh.bvh;
+    if (bvh.nodes.empty()) return false;
+
+    const glm::vec3 invRayDir(1.0f / rayDir.x, 1.0f / rayDir.y, 1.0f / rayDir.z);
+    bool hit = false;
+
+    if (intersectRayBounds(rayOrigin, invRayDir, bvh.nodes[0].boundsMin, bvh.nodes[0].boundsMax, t) == std::numeric_limits<float>::max()) return false;
+
+    std::vector<unsigned int> stack;
+    stack.reserve(64);
+    stack.push_back(0);
+
+    while (!stack.empty()) {
+        const BVHNode& node = bvh.nodes[stack.back()];
+        stack.pop_back();
+
+        if (node.isLeaf()) {
+            for (unsigned int i = 0; i < node.triCount; ++i) {
+                unsigned int tri = bvh.triIndices[node.leftFirst + i];
+                const glm::vec3& v0 = mesh.positions[mesh.indices[tri * 3 + 0]];
+                const glm::vec3& v1 = mesh.positions[mesh.indices[tri * 3 + 1]];
+                const glm::vec3& v2 = mesh.positions[mesh.indices[tri * 3 + 2]];
+
+                float triT;
+                if (intersectRayTriangle(rayOrigin, rayDir, v0, v1, v2, triT) && triT < t) {
+                    t = triT;
+                    hit = true;
                 }
+            }
+            continue;
+        }
+
+        unsigned int nearChild = node.leftFirst, farChild = node.leftFirst + 1;
+        float nearT = intersectRayBounds(rayOrigin, invRayDir, bvh.nodes[nearChild].boundsMin, bvh.nodes[nearChild].boundsMax, t);
+        float farT = intersectRayBounds(rayOrigin, invRayDir, bvh.nodes[farChild].boundsMin, bvh.nodes[farChild].boundsMax, t);
+        if (farT < nearT) {
+            std::swap(nearChild, farChild);
+            std::swap(nearT, farT);
+        }
+
+        // Push the far child first so the near one is visited next and can shrink t before the far one is tested
+        if (farT != std::numeric_limits<float>::max()) stack.push_back(farChild);
+        if (nearT != std::numeric_limits<float>::max()) stack.push_back(nearChild);
+    }
+
+    return hit;
+}
+
+void buildMeshBVH(CpuMesh& mesh) {
+    const unsigned int BIN_COUNT = 16, MAX_LEAF_TRIANGLES = 4;
+    const unsigned int triCount = static_cast<unsigned int>(mesh.indices.size() / 3);
+
+    MeshBVH& bvh = mesh.bvh;
+    bvh.nodes.clear();
+    bvh.triIndices.resize(triCount);
+    if (triCount == 0) return;
+
+    std::vector<glm::vec3> triMin(triCount), triMax(triCount), centroids(triCount);
+    for (unsigned int i = 0; i < triCount; ++i) {
+        const glm::vec3& v0 = mesh.positions[mesh.indices[i * 3 + 0]];
+        const glm::vec3& v1 = mesh.positions[mesh.indices[i * 3 + 1]];
+        const glm::vec3& v2 = mesh.positions[mesh.indices[i * 3 + 2]];
+        triMin[i] = glm::min(v0, glm::min(v1, v2));
+        triMax[i] = glm::max(v0, glm::max(v1, v2));
+        centroids[i] = (v0 + v1 + v2) / 3.0f;
+        bvh.triIndices[i] = i;
+    }
 
-                if (closestObjectT < closestDistance) {
-                    closestDistance = closestObjectT;
-                    closestObjectIndex = static_cast<int>(i);
+    auto surfaceArea = [](const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+        glm::vec3 extent = boundsMax - boundsMin;
+        return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+    };
+
+    auto updateBounds = [&](BVHNode& node) {
+        node.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+        node.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+        for (unsigned int i = 0; i < node.triCount; ++i) {
+            unsigned int tri = bvh.triIndices[node.leftFirst + i];
+            node.boundsMin = glm::min(node.boundsMin, triMin[tri]);
+            node.boundsMax = glm::max(node.boundsMax, triMax[tri]);
+        }
+    };
+
+    bvh.nodes.reserve(triCount * 2 - 1);
+    BVHNode root;
+    root.leftFirst = 0;
+    root.triCount = triCount;
+    updateBounds(root);
+    bvh.nodes.push_back(root);
+
+    std::vector<unsigned int> pending{ 0 };
+    while (!pending.empty()) {
+        unsigned int nodeIndex = pending.back();
+        pending.pop_back();
+        BVHNode node = bvh.nodes[nodeIndex];
+        if (node.triCount <= MAX_LEAF_TRIANGLES) continue;
+
+        glm::vec3 centroidMin(std::numeric_limits<float>::max()), centroidMax(-std::numeric_limits<float>::max());
+        for (unsigned int i = 0; i < node.triCount; ++i) {
+            const glm::vec3& c = centroids[bvh.triIndices[node.leftFirst + i]];
+            centroidMin = glm::min(centroidMin, c);
+            centroidMax = glm::max(centroidMax, c);
+        }
+
+        int bestAxis = -1;
+        unsigned int bestSplit = 0;
+        float bestCost = surfaceArea(node.boundsMin, node.boundsMax) * node.triCount;
+
+        for (int axis = 0; axis < 3; ++axis) {
+            float axisExtent = centroidMax[axis] - centroidMin[axis];
+            if (axisExtent <= 0.0f) continue;
+
+            glm::vec3 binMin[BIN_COUNT], binMax[BIN_COUNT];
+            unsigned int binCount[BIN_COUNT] = {};
+            for (unsigned int b = 0; b < BIN_COUNT; ++b) {
+                binMin[b] = glm::vec3(std::numeric_limits<float>::max());
+                binMax[b] = glm::vec3(-std::numeric_limits<float>::max());
+            }
+
+            float binScale = BIN_COUNT / axisExtent;
+            for (unsigned int i = 0; i < node.triCount; ++i) {
+                unsigned int tri = bvh.triIndices[node.leftFirst + i];
+                unsigned int b = std::min(BIN_COUNT - 1, static_cast<unsigned int>((centroids[tri][axis] - centroidMin[axis]) * binScale));
+                binCount[b]++;
+                binMin[b] = glm::min(binMin[b], triMin[tri]);
+                binMax[b] = glm::max(binMax[b], triMax[tri]);
+            }
+
+            // Sweep from both ends so each split plane's cost is evaluated in O(1)
+            float leftArea[BIN_COUNT - 1], rightArea[BIN_COUNT - 1];
+            unsigned int leftCount[BIN_COUNT - 1], rightCount[BIN_COUNT - 1];
+            glm::vec3 leftMin(std::numeric_limits<float>::max()), leftMax(-std::numeric_limits<float>::max());
+            glm::vec3 rightMin = leftMin, rightMax = leftMax;
+            unsigned int leftSum = 0, rightSum = 0;
+            for (unsigned int b = 0; b < BIN_COUNT - 1; ++b) {
+                leftSum += binCount[b];
+                leftMin = glm::min(leftMin, binMin[b]);
+                leftMax = glm::max(leftMax, binMax[b]);
+                leftCount[b] = leftSum;
+                leftArea[b] = leftSum ? surfaceArea(leftMin, leftMax) : 0.0f;
+
+                unsigned int r = BIN_COUNT - 1 - b;
+                rightSum += binCount[r];
+                rightMin = glm::min(rightMin, binMin[r]);
+                rightMax = glm::max(rightMax, binMax[r]);
+                rightCount[r - 1] = rightSum;
+                rightArea[r - 1] = rightSum ? surfaceArea(rightMin, rightMax) : 0.0f;
+            }
+
+            for (unsigned int b = 0; b < BIN_COUNT - 1; ++b) {
+                if (leftCount[b] == 0 || rightCount[b] == 0) continue;
+                float cost = leftArea[b] * leftCount[b] + rightArea[b] * rightCount[b];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b;
                 }
             }
+        }
+
+        if (bestAxis < 0) continue;
+
+        float splitScale = BIN_COUNT / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        auto begin = bvh.triIndices.begin() + node.leftFirst;
+        auto middle = std::partition(begin, begin + node.triCount, [&](unsigned int tri) {
+            return std::min(BIN_COUNT - 1, static_cast<unsigned int>((centroids[tri][bestAxis] - centroidMin[bestAxis]) * splitScale)) <= bestSplit;
+        });
+        unsigned int leftTriCount = static_cast<unsigned int>(middle - begin);
+
+        BVHNode left, right;
+        left.leftFirst = node.leftFirst;
+        left.triCount = leftTriCount;
+        right.leftFirst = node.leftFirst + leftTriCount;
+        right.triCount = node.triCount - leftTriCount;
+        updateBounds(left);
+        updateBounds(right);
+
+        unsigned int leftIndex = static_cast<unsigned int>(bvh.nodes.size());
+        bvh.nodes.push_back(left);
+        bvh.nodes.push_back(right);
+        bvh.nodes[nodeIndex].leftFirst = leftIndex;
+        bvh.nodes[nodeIndex].triCount = 0;
+
+        pending.push_back(leftIndex);
+        pending.push_back(leftIndex + 1);
+    }
+}
+
+// Returns the dense index of the nearest object hit, or -1
+int pickImportedObject(const glm::vec3& rayOrigin, const glm::vec3& rayDirection) {
+    int closestObjectIndex = -1;
+    float closestDistance = std::numeric_limits<float>::max();
+
+    sceneObjects.updateTransforms();
+    const BoundsTable& bounds = sceneObjects.bounds();
+    float directionLengthSquared = glm::dot(rayDirection, rayDirection);
+
+    for (size_t i = 0; i < sceneObjects.size(); ++i) {
+        // Bounding sphere test on the packed bounds before touching the mesh; t is in ray-direction units
+        glm::vec3 toCenter = glm::vec3(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]) - rayOrigin;
+        float along = glm::dot(toCenter, rayDirection) / directionLengthSquared;
+        float missSquared = glm::dot(toCenter, toCenter) - along * along * directionLengthSquared;
+        float radiusSquared = bounds.radius[i] * bounds.radius[i];
+        if (bounds.radius[i] < 0.0f || missSquared > radiusSquared) continue;
+        float halfChord = std::sqrt((radiusSquared - missSquared) / directionLengthSquared);
+        if (along + halfChord < 0.0f || along - halfChord > closestDistance) continue;
+
+        const std::shared_ptr<MeshAsset>& mesh = sceneObjects.meshes[i];
+        if (!mesh || !mesh->cpuMesh) continue;
+
+        // The direction is left unnormalized so that t stays in world-space ray units
+        glm::mat4 inverseModel = glm::inverse(sceneObjects.worldMatrix(i));
+        glm::vec3 localOrigin = glm::vec3(inverseModel * glm::vec4(rayOrigin, 1.0f));
+        glm::vec3 localDirection = glm::vec3(inverseModel * glm::vec4(rayDirection, 0.0f));
+
+        float t = closestDistance;
+        if (intersectRayMesh(*mesh->cpuMesh, localOrigin, localDirection, t) && t < closestDistance) {
+            closestDistance = t;
+            closestObjectIndex = static_cast<int>(i);
+        }
+    }
+
+    return closestObjectIndex;
+}
+
+// Picks from the integer ID attachment of the scene pass instead of ray casting meshes, which also covers
+// lights and supports dragging a marquee
+bool idBufferPicking = true;
+// Shorter drags than this, in window pixels, count as a click
+const double MARQUEE_MIN_DRAG = 4.0;
+
+// Left-button drag in window coordinates, tracked while ID-buffer picking is on
+struct MarqueeDrag {
+    bool active, additive;
+    double startX, startY;
+    MarqueeDrag() : active(false), additive(false), startX(0.0), startY(0.0) {}
+};
+
+// Inclusive rectangle of scene framebuffer pixels, bottom-left origin, waiting for the next scene pass
+struct PickRequest {
+    bool pending, additive, marquee;
+    int x0, y0, x1, y1;
+    PickRequest() : pending(false), additive(false), marquee(false), x0(0), y0(0), x1(0), y1(0) {}
+};
+
+MarqueeDrag marqueeDrag;
+PickRequest pickRequest;
+
+// The scene is composited right of the properties panel; the cursor is in window units, which may not be pixels
+glm::ivec2 windowToScenePixel(GLFWwindow* window, double x, double y) {
+    int windowWidth, windowHeight, framebufferWidth, framebufferHeight;
+    glfwGetWindowSize(window, &windowWidth, &windowHeight);
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    double scaleX = windowWidth > 0 ? double(framebufferWidth) / windowWidth : 1.0;
+    double scaleY = windowHeight > 0 ? double(framebufferHeight) / windowHeight : 1.0;
+    return glm::ivec2(static_cast<int>(x * scaleX) - static_cast<int>(OBJECT_PROPERTIES_PANEL_WIDTH),
+        framebufferHeight - 1 - static_cast<int>(y * scaleY));
+}
+
+void requestIdBufferPick(GLFWwindow* window, const MarqueeDrag& drag, double endX, double endY) {
+    glm::ivec2 start = windowToScenePixel(window, drag.startX, drag.startY);
+    glm::ivec2 end = windowToScenePixel(window, endX, endY);
+
+    pickRequest.pending = true;
+    pickRequest.additive = drag.additive;
+    pickRequest.marquee = std::max(std::abs(endX - drag.startX), std::abs(endY - drag.startY)) >= MARQUEE_MIN_DRAG;
+    if (!pickRequest.marquee) start = end;
+    pickRequest.x0 = std::min(start.x, end.x);
+    pickRequest.y0 = std::min(start.y, end.y);
+    pickRequest.x1 = std::max(start.x, end.x);
+    pickRequest.y1 = std::max(start.y, end.y);
+}
+
+void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
+    ImGuiIO& io = ImGui::GetIO();
+    io.AddMouseButtonEvent(button, action == GLFW_PRESS);
+
+    if (io.WantCaptureMouse) return;
+
+    if (action == GLFW_PRESS) {
+        if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS && button == GLFW_MOUSE_BUTTON_LEFT) {
+            isRolling = true;
+            glfwGetCursorPos(window, &lastMouseX, &lastMouseY);
+        }
+        else if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS && button == GLFW_MOUSE_BUTTON_LEFT) {
+            isTargetMoving = true;
+            glfwGetCursorPos(window, &lastMouseX, &lastMouseY);
+        }
+        else if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS && button == GLFW_MOUSE_BUTTON_RIGHT) {
+            isCameraMoving = true;
+            glfwGetCursorPos(window, &lastMouseX, &lastMouseY);
+        }
+        if (button == GLFW_MOUSE_BUTTON_LEFT && idBufferPicking) {
+            // The pick is issued on release, once it is known whether this was a click or a marquee
+            if (!isRolling && !isTargetMoving) {
+                marqueeDrag.active = true;
+                marqueeDrag.additive = (mods & GLFW_MOD_SHIFT) != 0;
+                glfwGetCursorPos(window, &marqueeDrag.startX, &marqueeDrag.startY);
+            }
+        }
+        else if (button == GLFW_MOUSE_BUTTON_LEFT) {
+            double mouseX, mouseY;
+            glfwGetCursorPos(window, &mouseX, &mouseY);
 
-            if (closestObjectIndex >= 0 && closestObjectIndex < static_cast<int>(importedObjects.size())) {
-                selectedObject.type = SelectedObject::IMPORTED_OBJECT;
-                selectedObject.index = closestObjectIndex;
-                std::cout << "Selected Imported Object Index: " << selectedObject.index << std::endl;
+            int screenWidth, screenHeight;
+            glfwGetFramebufferSize(window, &screenWidth, &screenHeight);
+
+            glm::mat4 view = glm::lookAt(cameraPos, cameraTarget, cameraUp);
+            glm::vec3 rayOrigin = cameraPos;
+            glm::vec3 rayDirection = getRayFromScreenCoords(mouseX, mouseY, screenWidth, screenHeight, projection, view);
+
+            int closestObjectIndex = pickImportedObject(rayOrigin, rayDirection);
+            if (closestObjectIndex >= 0 && closestObjectIndex < static_cast<int>(sceneObjects.size())) {
+                selectedObject.select(SelectedObject::IMPORTED_OBJECT, sceneObjects.handle(closestObjectIndex));
+                std::cout << "Selected Imported Object Index: " << closestObjectIndex << std::endl;
             }
             else {
                 selectedObject.clear();
@@ -288,6 +1736,12 @@ void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
         if (button == GLFW_MOUSE_BUTTON_LEFT) {
             isRolling = false;
             isTargetMoving = false;
+            if (marqueeDrag.active) {
+                double mouseX, mouseY;
+                glfwGetCursorPos(window, &mouseX, &mouseY);
+                requestIdBufferPick(window, marqueeDrag, mouseX, mouseY);
+                marqueeDrag.active = false;
+            }
         }
         if (button == GLFW_MOUSE_BUTTON_RIGHT) {
             isCameraMoving = false;
@@ -368,103 +1822,129 @@ void scrollCallback(GLFWwindow* window, double xoffset, double yoffset) {
     cameraTarget += viewDirection * static_cast<float>(yoffset) * zoomSpeed;
 }
 
-void setupGrid(float gridScale = 1.0f, int gridSize = 100) {
-    gridVertices.clear();
-    const float step = gridScale;
-
-    for (int i = -gridSize; i <= gridSize; ++i) {
-        gridVertices.insert(gridVertices.end(), { i * step, 0.0f, -gridSize * step, i * step, 0.0f, gridSize * step });
-        gridVertices.insert(gridVertices.end(), { -gridSize * step, 0.0f, i * step, gridSize * step, 0.0f, i * step });
-    }
-
-    glGenVertexArrays(1, &gridVAO);
-    glGenBuffers(1, &gridVBO);
-    glBindVertexArray(gridVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, gridVBO);
-    glBufferData(GL_ARRAY_BUFFER, gridVertices.size() * sizeof(float), gridVertices.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-}
-
-void renderGrid(GLuint shaderProgram, const glm::mat4& view, const glm::mat4& projection) {
-    glUseProgram(shaderProgram);
-
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(glm::mat4(1.0f)));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-
-    glUniform3f(glGetUniformLocation(shaderProgram, "mainLineColor"), 0.0f, 0.0f, 0.0f);
-    glUniform3f(glGetUniformLocation(shaderProgram, "secondaryLineColor"), 0.5f, 0.5f, 0.5f);
-
-    glEnable(GL_POLYGON_OFFSET_FILL);
-    glPolygonOffset(1.0f, 1.0f);
-
-    glBindVertexArray(gridVAO);
-    glDrawArrays(GL_LINES, 0, static_cast<GLsizei>(gridVertices.size() / 3));
-
-    glDisable(GL_POLYGON_OFFSET_FILL);
-    glBindVertexArray(0);
-}
-
 const char* vertexShaderSource = R"(
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
+layout (location = 2) in mat4 model;
+layout (location = 6) in mat3 normalMatrix;
+layout (location = 9) in uint pickId;
+
+layout (std140) uniform CameraBlock {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPosition;
+};
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform bool octahedralNormals;
 
 out vec3 FragPos;
 out vec3 Normal;
+flat out uint PickId;
+
+// The depth pre-pass and the lit pass must produce bit-identical depth for GL_EQUAL to pass
+invariant gl_Position;
+
+vec3 decodeOctahedral(vec2 encoded) {
+    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float fold = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -fold : fold;
+    n.y += n.y >= 0.0 ? -fold : fold;
+    return normalize(n);
+}
 
 void main() {
     FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    Normal = normalMatrix * (octahedralNormals ? decodeOctahedral(aNormal.xy) : aNormal);
+    PickId = pickId;
     gl_Position = projection * view * model * vec4(aPos, 1.0);
 }
 )";
 
 const char* fragmentShaderSource = R"(
 #version 330 core
-out vec4 FragColor;
+layout (location = 0) out vec4 FragColor;
+// Written to the scene framebuffer's ID attachment for picking
+layout (location = 2) out uint PickOutput;
 
 in vec3 FragPos;
 in vec3 Normal;
+flat in uint PickId;
 
-struct Light {
-    vec3 position;
-    vec3 direction;
-    vec3 color;
-    float brightness;
-    float cutOff;
-    float outerCutOff;
-    float constant;
-    float linear;
-    float quadratic;
+layout (std140) uniform CameraBlock {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPosition;
 };
 
-uniform vec3 viewPosition;
-uniform Light lights[10];
-uniform int numLights;
+layout (std140) uniform LightBlock {
+    uvec4 clusterDimensions;
+    vec4 clusterParams;
+};
+
+// Four texels per light: position + brightness, direction + cutOff, color + outerCutOff, attenuation + range
+uniform samplerBuffer lightData;
+// Per cluster: offset into clusterLightIndices and light count
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterLightIndices;
+
+uniform sampler2DShadow shadowAtlas;
+// Five texels per light: world to atlas matrix, then the tile's UV bounds, with x < 0 for lights without a shadow map
+uniform samplerBuffer shadowData;
 
 uniform vec3 objectColor;
 
+// 3x3 taps of the hardware 2x2 comparison filter, kept inside the light's tile
+float shadowVisibility(int light, vec3 position) {
+    vec4 tileBounds = texelFetch(shadowData, light * 5 + 4);
+    if (tileBounds.x < 0.0) return 1.0;
+
+    mat4 worldToAtlas = mat4(texelFetch(shadowData, light * 5), texelFetch(shadowData, light * 5 + 1),
+        texelFetch(shadowData, light * 5 + 2), texelFetch(shadowData, light * 5 + 3));
+    vec4 coord = worldToAtlas * vec4(position, 1.0);
+    if (coord.w <= 0.0) return 1.0;
+    vec3 projected = coord.xyz / coord.w;
+
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowAtlas, 0));
+    float visibility = 0.0;
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+            vec2 uv = clamp(projected.xy + vec2(x, y) * texelSize, tileBounds.xy, tileBounds.zw);
+            visibility += textureLod(shadowAtlas, vec3(uv, projected.z), 0.0);
+        }
+    }
+    return visibility / 9.0;
+}
+
 void main() {
     vec3 result = vec3(0.0);
     vec3 norm = normalize(Normal);
-    vec3 viewDir = normalize(viewPosition - FragPos);
+    vec3 viewDir = normalize(viewPosition.xyz - FragPos);
+
+    float viewDepth = -(view * vec4(FragPos, 1.0)).z;
+    uvec3 cluster = uvec3(uvec2(gl_FragCoord.xy / clusterParams.xy), uint(max(log(viewDepth) * clusterParams.z - clusterParams.w, 0.0)));
+    cluster = min(cluster, clusterDimensions.xyz - 1u);
+    uvec2 lightRange = texelFetch(clusterGrid, int(cluster.x + clusterDimensions.x * (cluster.y + clusterDimensions.y * cluster.z))).xy;
 
-    for (int i = 0; i < numLights; i++) {
-        Light light = lights[i];
+    for (uint i = 0u; i < lightRange.y; i++) {
+        int lightIndex = int(texelFetch(clusterLightIndices, int(lightRange.x + i)).r);
+        int lightOffset = lightIndex * 4;
+        vec4 positionBrightness = texelFetch(lightData, lightOffset);
+        vec4 directionCutOff = texelFetch(lightData, lightOffset + 1);
+        vec4 colorOuterCutOff = texelFetch(lightData, lightOffset + 2);
+        vec4 attenuationRange = texelFetch(lightData, lightOffset + 3);
 
-        vec3 lightColor = light.color * light.brightness;
+        vec3 lightPosition = positionBrightness.xyz;
+        float cutOff = directionCutOff.w;
+        float outerCutOff = colorOuterCutOff.w;
 
-        vec3 lightDir = normalize(light.position - FragPos);
+        vec3 lightColor = colorOuterCutOff.rgb * positionBrightness.w;
 
-        float theta = dot(lightDir, normalize(-light.direction));
-        float epsilon = light.cutOff - light.outerCutOff;
-        float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+        vec3 lightDir = normalize(lightPosition - FragPos);
+
+        float theta = dot(lightDir, normalize(-directionCutOff.xyz));
+        float epsilon = cutOff - outerCutOff;
+        float intensity = clamp((theta - outerCutOff) / epsilon, 0.0, 1.0);
 
         vec3 ambient = 0.1 * lightColor;
 
@@ -475,283 +1955,4059 @@ void main() {
         float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
         vec3 specular = 0.5 * spec * lightColor;
 
-        float distance = length(light.position - FragPos);
-        float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+        float distance = length(lightPosition - FragPos);
+        float attenuation = 1.0 / (attenuationRange.x + attenuationRange.y * distance + attenuationRange.z * (distance * distance));
+        // Fade to zero at the range so clipping a light at its cluster bounds leaves no visible edge
+        float window = clamp(1.0 - pow(distance / attenuationRange.w, 4.0), 0.0, 1.0);
+        attenuation *= window * window;
 
-        result += (ambient + diffuse * intensity + specular * intensity) * attenuation;
+        // The atlas is only read where the light actually reaches
+        float shadow = intensity * attenuation > 0.0 ? shadowVisibility(lightIndex, FragPos) : 1.0;
+        result += (ambient + (diffuse + specular) * intensity * shadow) * attenuation;
     }
 
     result *= objectColor;
     FragColor = vec4(result, 1.0);
+    PickOutput = PickId;
 }
 )";
 
+// Full-screen triangle that carries the camera ray through each pixel to the grid fragment shader
 const char* gridVertexShaderSource = R"(
 #version 330 core
-layout (location = 0) in vec3 aPos;
+layout (std140) uniform CameraBlock {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPosition;
+};
 
-uniform mat4 model, view, projection;
+out vec3 nearPoint;
+out vec3 farPoint;
 
-out vec3 fragPosition;
+vec3 unproject(vec2 ndc, float depth, mat4 inverseViewProjection) {
+    vec4 point = inverseViewProjection * vec4(ndc, depth, 1.0);
+    return point.xyz / point.w;
+}
 
 void main() {
-    fragPosition = aPos;
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    vec2 ndc = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    mat4 inverseViewProjection = inverse(projection * view);
+    nearPoint = unproject(ndc, -1.0, inverseViewProjection);
+    farPoint = unproject(ndc, 1.0, inverseViewProjection);
+    gl_Position = vec4(ndc, 0.0, 1.0);
 }
 )";
 
+// Intersects the pixel's ray with y = 0 and derives the lines analytically. The cell size steps by 10x as
+// lines get denser on screen, cross-fading the finest level, so the cost per pixel is constant at any zoom.
 const char* gridFragmentShaderSource = R"(
 #version 330 core
 out vec4 FragColor;
 
-in vec3 fragPosition;
+in vec3 nearPoint;
+in vec3 farPoint;
+
+layout (std140) uniform CameraBlock {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPosition;
+};
 
-uniform float gridScale;
 uniform vec3 mainLineColor;
 uniform vec3 secondaryLineColor;
 
+const float BASE_CELL_SIZE = 1.0;
+const float MIN_PIXELS_BETWEEN_LINES = 8.0;
+const float FADE_DISTANCE_PER_HEIGHT = 80.0;
+
+// One-pixel lines spaced cellSize apart, antialiased with the screen-space derivative
+float lineCoverage(vec2 coord, vec2 derivative, float cellSize) {
+    vec2 distanceToLine = abs(fract(coord / cellSize - 0.5) - 0.5) * cellSize / derivative;
+    return 1.0 - min(min(distanceToLine.x, distanceToLine.y), 1.0);
+}
+
 void main() {
-    float nearX = abs(fragPosition.x) < 0.01 ? 1.0 : 0.0;
-    float nearZ = abs(fragPosition.z) < 0.01 ? 1.0 : 0.0;
+    float t = -nearPoint.y / (farPoint.y - nearPoint.y);
+    if (t <= 0.0) discard;
+
+    vec3 position = nearPoint + t * (farPoint - nearPoint);
+    vec4 clipPosition = projection * view * vec4(position, 1.0);
+    float ndcDepth = clipPosition.z / clipPosition.w;
+    if (ndcDepth > 1.0) discard;
+    gl_FragDepth = ndcDepth * 0.5 + 0.5;
+
+    vec2 coord = position.xz;
+    vec2 derivative = max(fwidth(coord), vec2(1e-6));
 
-    vec3 gridColor = mix(secondaryLineColor, mainLineColor, nearX + nearZ);
+    float level = max(log(length(derivative) * MIN_PIXELS_BETWEEN_LINES / BASE_CELL_SIZE) / log(10.0) + 1.0, 0.0);
+    float levelFade = fract(level);
+    float cellSize = BASE_CELL_SIZE * pow(10.0, floor(level));
 
-    FragColor = vec4(gridColor, 1.0);
+    float minor = lineCoverage(coord, derivative, cellSize) * (1.0 - levelFade);
+    float major = lineCoverage(coord, derivative, cellSize * 10.0);
+    float coarse = lineCoverage(coord, derivative, cellSize * 100.0);
+    float alpha = max(max(minor * 0.5, major * 0.75), coarse);
+
+    vec2 distanceToAxis = abs(coord) / (derivative * 1.5);
+    float axis = 1.0 - min(min(distanceToAxis.x, distanceToAxis.y), 1.0);
+    vec3 color = mix(secondaryLineColor, mainLineColor, axis);
+    alpha = max(alpha, axis);
+
+    float fadeDistance = FADE_DISTANCE_PER_HEIGHT * max(abs(viewPosition.y), 1.0);
+    alpha *= 1.0 - smoothstep(0.5 * fadeDistance, fadeDistance, length(position - viewPosition.xyz));
+    if (alpha <= 0.0) discard;
+
+    FragColor = vec4(color, alpha);
 }
 )";
 
-const char* outlineFragmentShaderSource = R"(
+const char* fullscreenVertexShaderSource = R"(
 #version 330 core
-out vec4 FragColor;
-
-uniform vec3 outlineColor;
+out vec2 uv;
 
 void main() {
-    FragColor = vec4(outlineColor, 1.0);
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    uv = corner;
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
 }
 )";
 
-const char* outlineVertexShaderSource = R"(
+const char* selectionMaskFragmentShaderSource = R"(
 #version 330 core
-layout (location = 0) in vec3 aPos;
-
-uniform mat4 model, view, projection;
+out float mask;
 
 void main() {
-    float outlineScale = 1.02;
-    gl_Position = projection * view * model * vec4(aPos * outlineScale, 1.0);
+    mask = 1.0;
 }
 )";
 
-const char* lightCubeVertexShaderSource = R"(
+const char* compositeFragmentShaderSource = R"(
 #version 330 core
-layout (location = 0) in vec3 aPos;
+out vec4 FragColor;
+
+in vec2 uv;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform sampler2D sceneColor;
+uniform sampler2D selectionMask;
+uniform vec3 outlineColor;
+
+const int OUTLINE_WIDTH = 2;
 
 void main() {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    vec3 color = texture(sceneColor, uv).rgb;
+    ivec2 maskSize = textureSize(selectionMask, 0);
+    ivec2 pixel = ivec2(uv * vec2(maskSize));
+
+    float inside = texelFetch(selectionMask, pixel, 0).r;
+    float neighbourhood = 0.0;
+    for (int y = -OUTLINE_WIDTH; y <= OUTLINE_WIDTH; y++) {
+        for (int x = -OUTLINE_WIDTH; x <= OUTLINE_WIDTH; x++) {
+            ivec2 neighbour = clamp(pixel + ivec2(x, y), ivec2(0), maskSize - 1);
+            neighbourhood = max(neighbourhood, texelFetch(selectionMask, neighbour, 0).r);
+        }
+    }
+
+    FragColor = vec4(mix(color, outlineColor, neighbourhood * (1.0 - inside)), 1.0);
 }
 )";
 
-const char* lightCubeFragmentShaderSource = R"(
+// Used with the object vertex shader for the depth pre-pass, and with the box shader for occlusion queries
+const char* depthOnlyFragmentShaderSource = R"(
 #version 330 core
-out vec4 FragColor;
+void main() {
+}
+)";
+
+// Depth-only instanced draw into a spotlight's shadow atlas tile
+const char* shadowVertexShaderSource = R"(
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 2) in mat4 model;
 
-uniform vec3 lightColor;
+uniform mat4 lightViewProjection;
 
 void main() {
-    FragColor = vec4(lightColor, 1.0);
+    gl_Position = lightViewProjection * model * vec4(aPos, 1.0);
 }
 )";
 
-GLuint createShaderProgram(const char* vShaderSrc, const char* fShaderSrc) {
-    auto compileShader = [](GLenum type, const char* src) {
-        GLuint shader = glCreateShader(type);
-        glShaderSource(shader, 1, &src, nullptr);
-        glCompileShader(shader);
-        return shader;
-    };
+// GPU-driven variant of vertexShaderSource: the per-object data comes from a storage buffer indexed by an
+// instanced attribute that baseInstance points at the right entry of the slot table
+const char* indirectVertexShaderSource = R"(
+#version 430 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in uint objectIndex;
 
-    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vShaderSrc);
-    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fShaderSrc);
+struct ObjectRecord {
+    mat4 model;
+    vec4 normalMatrix[3];
+    vec4 sphere;
+    uvec4 mesh;
+};
 
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
+layout (std430, binding = 0) readonly buffer ObjectRecords {
+    ObjectRecord objects[];
+};
 
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-    return shaderProgram;
-}
+layout (std140) uniform CameraBlock {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPosition;
+};
 
-void importObject(const std::string& filePath) {
-    Assimp::Importer importer;
-    const aiScene* scene = importer.ReadFile(filePath, aiProcess_Triangulate | aiProcess_GenNormals | aiProcess_FlipUVs);
+uniform bool octahedralNormals;
 
-    if (!scene || !scene->mRootNode || (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE)) {
-        std::cerr << "Error loading model: " << importer.GetErrorString() << std::endl;
-        return;
-    }
+out vec3 FragPos;
+out vec3 Normal;
+flat out uint PickId;
 
-    for (unsigned int meshIndex = 0; meshIndex < scene->mNumMeshes; ++meshIndex) {
-        aiMesh* mesh = scene->mMeshes[meshIndex];
-        std::vector<float> vertices(mesh->mNumVertices * 6);
-        std::vector<unsigned int> indices;
+invariant gl_Position;
+
+vec3 decodeOctahedral(vec2 encoded) {
+    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float fold = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -fold : fold;
+    n.y += n.y >= 0.0 ? -fold : fold;
+    return normalize(n);
+}
+
+void main() {
+    mat4 model = objects[objectIndex].model;
+    mat3 normalMatrix = mat3(objects[objectIndex].normalMatrix[0].xyz, objects[objectIndex].normalMatrix[1].xyz, objects[objectIndex].normalMatrix[2].xyz);
+    FragPos = vec3(model * vec4(aPos, 1.0));
+    Normal = normalMatrix * (octahedralNormals ? decodeOctahedral(aNormal.xy) : aNormal);
+    PickId = objectIndex + 1u;
+    gl_Position = projection * view * model * vec4(aPos, 1.0);
+}
+)";
+
+// One invocation per draw slot: frustum-tests the object's bounding sphere, picks its LOD the same way
+// selectLodLevel() does and writes the slot's indirect command, with no instances when it is culled
+const char* indirectCullComputeShaderSource = R"(
+#version 430 core
+layout (local_size_x = 64) in;
+
+struct ObjectRecord {
+    mat4 model;
+    vec4 normalMatrix[3];
+    vec4 sphere;
+    uvec4 mesh;
+};
+
+// header: base vertex, LOD count, bounding radius bits; lods: first index, index count, error bits
+struct MeshRecord {
+    ivec4 header;
+    uvec4 lods[4];
+};
+
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout (std430, binding = 0) readonly buffer ObjectRecords {
+    ObjectRecord objects[];
+};
+layout (std430, binding = 1) readonly buffer MeshRecords {
+    MeshRecord meshes[];
+};
+layout (std430, binding = 2) readonly buffer SlotObjects {
+    uint slotObjects[];
+};
+layout (std430, binding = 3) buffer LodLevels {
+    uint lodLevels[];
+};
+layout (std430, binding = 4) writeonly buffer DrawCommands {
+    DrawCommand commands[];
+};
+
+uniform vec4 frustumPlanes[6];
+uniform vec3 eyePosition;
+uniform float pixelsPerUnit;
+uniform float lodPixelError;
+uniform float lodHysteresis;
+uniform uint slotCount;
+
+void main() {
+    uint slot = gl_GlobalInvocationID.x;
+    if (slot >= slotCount) return;
+
+    uint object = slotObjects[slot];
+    vec4 sphere = objects[object].sphere;
+    MeshRecord mesh = meshes[objects[object].mesh.x];
+
+    bool visible = true;
+    for (int i = 0; i < 6; ++i) {
+        visible = visible && dot(frustumPlanes[i].xyz, sphere.xyz) + frustumPlanes[i].w >= -sphere.w;
+    }
+
+    uint previous = lodLevels[object];
+    uint level = 0u;
+    float distance = max(length(sphere.xyz - eyePosition) - sphere.w, 0.1);
+    float meshRadius = intBitsToFloat(mesh.header.z);
+    float scale = meshRadius > 0.0 ? sphere.w / meshRadius : 1.0;
+    float pixelsPerMeshUnit = pixelsPerUnit * scale / distance;
+    for (int i = mesh.header.y - 1; i > 0; --i) {
+        float threshold = lodPixelError;
+        if (uint(i) > previous) threshold *= 1.0 - lodHysteresis;
+        if (uintBitsToFloat(mesh.lods[i].z) * pixelsPerMeshUnit <= threshold) {
+            level = uint(i);
+            break;
+        }
+    }
+    if (visible) lodLevels[object] = level;
+
+    commands[slot].count = mesh.lods[level].y;
+    commands[slot].instanceCount = visible ? 1u : 0u;
+    commands[slot].firstIndex = mesh.lods[level].x;
+    commands[slot].baseVertex = mesh.header.x;
+    commands[slot].baseInstance = slot;
+}
+)";
+
+const char* occlusionBoxVertexShaderSource = R"(
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+layout (std140) uniform CameraBlock {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPosition;
+};
+
+uniform mat4 boxTransform;
+
+void main() {
+    gl_Position = projection * view * boxTransform * vec4(aPos, 1.0);
+}
+)";
+
+const char* lightCubeVertexShaderSource = R"(
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in mat4 model;
+layout (location = 5) in vec3 aLightColor;
+
+layout (std140) uniform CameraBlock {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPosition;
+};
+
+out vec3 lightColor;
+flat out uint PickId;
+
+void main() {
+    lightColor = aLightColor;
+    // Instances are laid out in dense light order
+    PickId = 0x80000000u | uint(gl_InstanceID + 1);
+    gl_Position = projection * view * model * vec4(aPos, 1.0);
+}
+)";
+
+const char* lightCubeFragmentShaderSource = R"(
+#version 330 core
+layout (location = 0) out vec4 FragColor;
+layout (location = 2) out uint PickOutput;
+
+in vec3 lightColor;
+flat in uint PickId;
+
+void main() {
+    FragColor = vec4(lightColor, 1.0);
+    PickOutput = PickId;
+}
+)";
+
+ShaderProgram createShaderProgram(const char* vShaderSrc, const char* fShaderSrc) {
+    auto compileShader = [](GLenum type, const char* src) {
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &src, nullptr);
+        glCompileShader(shader);
+        return shader;
+    };
+
+    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vShaderSrc);
+    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fShaderSrc);
+
+    GLuint shaderProgram = glCreateProgram();
+    glAttachShader(shaderProgram, vertexShader);
+    glAttachShader(shaderProgram, fragmentShader);
+    glLinkProgram(shaderProgram);
+
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    ShaderProgram program;
+    program.id = shaderProgram;
+    for (int i = 0; i < static_cast<int>(Uniform::COUNT); ++i) {
+        program.locations[i] = glGetUniformLocation(shaderProgram, UNIFORM_NAMES[i]);
+    }
+
+    GLuint cameraBlockIndex = glGetUniformBlockIndex(shaderProgram, "CameraBlock");
+    if (cameraBlockIndex != GL_INVALID_INDEX) glUniformBlockBinding(shaderProgram, cameraBlockIndex, CAMERA_BLOCK_BINDING);
+    GLuint lightBlockIndex = glGetUniformBlockIndex(shaderProgram, "LightBlock");
+    if (lightBlockIndex != GL_INVALID_INDEX) glUniformBlockBinding(shaderProgram, lightBlockIndex, LIGHT_BLOCK_BINDING);
+
+    return program;
+}
+
+// Returns a program with id 0 if the shader fails to compile or link
+ShaderProgram createComputeProgram(const char* computeShaderSrc) {
+    GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(computeShader, 1, &computeShaderSrc, nullptr);
+    glCompileShader(computeShader);
+
+    GLuint computeProgram = glCreateProgram();
+    glAttachShader(computeProgram, computeShader);
+    glLinkProgram(computeProgram);
+    glDeleteShader(computeShader);
+
+    ShaderProgram program;
+    GLint linked = GL_FALSE;
+    glGetProgramiv(computeProgram, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        char log[1024] = "";
+        glGetProgramInfoLog(computeProgram, sizeof(log), nullptr, log);
+        std::cerr << "Compute shader failed to link: " << log << std::endl;
+        glDeleteProgram(computeProgram);
+        return program;
+    }
+
+    program.id = computeProgram;
+    for (int i = 0; i < static_cast<int>(Uniform::COUNT); ++i) {
+        program.locations[i] = glGetUniformLocation(computeProgram, UNIFORM_NAMES[i]);
+    }
+    return program;
+}
+
+void setupUniformBuffers() {
+    glGenBuffers(1, &cameraUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, cameraUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlockData), nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, cameraUBO);
+
+    glGenBuffers(1, &lightUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, lightUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(LightBlockData), nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, LIGHT_BLOCK_BINDING, lightUBO);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void updateCameraBuffer(const glm::mat4& view, const glm::mat4& projection) {
+    static CameraBlockData uploaded;
+    static bool hasUploaded = false;
+
+    CameraBlockData data;
+    data.view = view;
+    data.projection = projection;
+    data.viewPosition = glm::vec4(cameraPos, 1.0f);
+    if (hasUploaded && memcmp(&data, &uploaded, sizeof(data)) == 0) return;
+
+    glBindBuffer(GL_UNIFORM_BUFFER, cameraUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(data), &data);
+    frameStats.bytesUploaded += sizeof(data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    uploaded = data;
+    hasUploaded = true;
+}
+
+struct LightInstance {
+    glm::mat4 model;
+    glm::vec3 color;
+};
+
+GLsizei lightInstanceCount = 0;
+
+void setupLightCubeInstances() {
+    glGenBuffers(1, &lightInstanceVBO);
+    glBindVertexArray(lightCubeVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, lightInstanceVBO);
+    for (GLuint column = 0; column < 4; ++column) {
+        glVertexAttribPointer(1 + column, 4, GL_FLOAT, GL_FALSE, sizeof(LightInstance), (void*)(offsetof(LightInstance, model) + column * sizeof(glm::vec4)));
+        glEnableVertexAttribArray(1 + column);
+        glVertexAttribDivisor(1 + column, 1);
+    }
+    glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, sizeof(LightInstance), (void*)offsetof(LightInstance, color));
+    glEnableVertexAttribArray(5);
+    glVertexAttribDivisor(5, 1);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Froxel grid over the view frustum: screen tiles times exponentially spaced depth slices
+const unsigned int CLUSTER_TILES_X = 16, CLUSTER_TILES_Y = 16, CLUSTER_SLICES = 24;
+const unsigned int CLUSTER_COUNT = CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES;
+const GLint LIGHT_DATA_TEXTURE_UNIT = 4, CLUSTER_GRID_TEXTURE_UNIT = 5, CLUSTER_LIGHT_INDEX_TEXTURE_UNIT = 6;
+// Below this many lights binning runs on the render thread alone
+const size_t PARALLEL_LIGHT_BINNING_THRESHOLD = 32;
+
+struct ClusterAABB {
+    glm::vec3 boundsMin, boundsMax;
+};
+
+struct LightClusters {
+    GLuint lightDataBuffer, lightDataTexture;
+    GLuint gridBuffer, gridTexture;
+    GLuint indexBuffer, indexTexture;
+
+    // Cached for the projection and framebuffer size the cluster bounds were built for
+    glm::mat4 projection;
+    int width, height;
+    float nearPlane, farPlane;
+    std::vector<ClusterAABB> bounds;
+
+    std::vector<std::vector<unsigned int>> clusterLights;
+    std::vector<unsigned int> grid;
+    std::vector<unsigned int> lightIndices;
+    unsigned int maxLightsPerCluster;
+
+    LightClusters()
+        : lightDataBuffer(0), lightDataTexture(0), gridBuffer(0), gridTexture(0), indexBuffer(0), indexTexture(0),
+        projection(0.0f), width(0), height(0), nearPlane(0.1f), farPlane(1000.0f), maxLightsPerCluster(0) {}
+};
+
+LightClusters lightClusters;
+
+GLuint createBufferTexture(GLuint& buffer, GLenum internalFormat) {
+    GLuint texture;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, internalFormat, buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    return texture;
+}
+
+void setupLightClusters() {
+    lightClusters.lightDataTexture = createBufferTexture(lightClusters.lightDataBuffer, GL_RGBA32F);
+    lightClusters.gridTexture = createBufferTexture(lightClusters.gridBuffer, GL_RG32UI);
+    lightClusters.indexTexture = createBufferTexture(lightClusters.indexBuffer, GL_R32UI);
+    lightClusters.clusterLights.resize(CLUSTER_COUNT);
+    lightClusters.grid.resize(CLUSTER_COUNT * 2);
+}
+
+// Orphans the buffer behind a buffer texture and refills it
+void uploadTextureBuffer(GLuint buffer, const void* data, size_t bytes) {
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(bytes, 16), nullptr, GL_STREAM_DRAW);
+    if (bytes > 0) glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+    frameStats.bytesUploaded += bytes;
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+float clusterSliceDepth(unsigned int slice) {
+    return lightClusters.nearPlane * std::pow(lightClusters.farPlane / lightClusters.nearPlane, static_cast<float>(slice) / CLUSTER_SLICES);
+}
+
+int clusterSliceForDepth(float depth) {
+    float slice = std::log(depth / lightClusters.nearPlane) / std::log(lightClusters.farPlane / lightClusters.nearPlane) * CLUSTER_SLICES;
+    return std::min(std::max(static_cast<int>(std::floor(slice)), 0), static_cast<int>(CLUSTER_SLICES) - 1);
+}
+
+// View-space bounds of every froxel; assumes a symmetric perspective projection like glm::perspective
+void buildClusterBounds(const glm::mat4& projection, int width, int height) {
+    LightClusters& clusters = lightClusters;
+    clusters.projection = projection;
+    clusters.width = width;
+    clusters.height = height;
+    clusters.nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+    clusters.farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+    clusters.bounds.resize(CLUSTER_COUNT);
+
+    for (unsigned int z = 0; z < CLUSTER_SLICES; ++z) {
+        float depths[2] = { clusterSliceDepth(z), clusterSliceDepth(z + 1) };
+        for (unsigned int y = 0; y < CLUSTER_TILES_Y; ++y) {
+            for (unsigned int x = 0; x < CLUSTER_TILES_X; ++x) {
+                float ndcX[2] = { 2.0f * x / CLUSTER_TILES_X - 1.0f, 2.0f * (x + 1) / CLUSTER_TILES_X - 1.0f };
+                float ndcY[2] = { 2.0f * y / CLUSTER_TILES_Y - 1.0f, 2.0f * (y + 1) / CLUSTER_TILES_Y - 1.0f };
+
+                ClusterAABB& box = clusters.bounds[x + CLUSTER_TILES_X * (y + CLUSTER_TILES_Y * z)];
+                box.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+                box.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+                for (float depth : depths) {
+                    for (float cornerX : ndcX) {
+                        for (float cornerY : ndcY) {
+                            glm::vec3 corner(cornerX * depth / projection[0][0], cornerY * depth / projection[1][1], -depth);
+                            box.boundsMin = glm::min(box.boundsMin, corner);
+                            box.boundsMax = glm::max(box.boundsMax, corner);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+struct LightBinningInput {
+    glm::vec3 center;
+    float radius;
+    int sliceMin, sliceMax, tileMinX, tileMaxX, tileMinY, tileMaxY;
+};
+
+// NDC x or y range of a view-space sphere interval across the given depth range, widened conservatively
+void projectedTileRange(float viewMin, float viewMax, float scale, float nearDepth, float farDepth, unsigned int tileCount, int& tileMin, int& tileMax) {
+    float ndcMin = scale * viewMin / (viewMin < 0.0f ? nearDepth : farDepth);
+    float ndcMax = scale * viewMax / (viewMax > 0.0f ? nearDepth : farDepth);
+    tileMin = std::max(static_cast<int>(std::floor((ndcMin * 0.5f + 0.5f) * tileCount)), 0);
+    tileMax = std::min(static_cast<int>(std::floor((ndcMax * 0.5f + 0.5f) * tileCount)), static_cast<int>(tileCount) - 1);
+}
+
+void updateLightClusters(const glm::mat4& view, int width, int height) {
+    LightClusters& clusters = lightClusters;
+    if (clusters.width != width || clusters.height != height || memcmp(&clusters.projection, &projection, sizeof(glm::mat4)) != 0) {
+        buildClusterBounds(projection, width, height);
+    }
 
-        for (unsigned int i = 0; i < mesh->mNumVertices; ++i) {
-            vertices[i * 6 + 0] = mesh->mVertices[i].x;
-            vertices[i * 6 + 1] = mesh->mVertices[i].y;
-            vertices[i * 6 + 2] = mesh->mVertices[i].z;
+    static std::vector<LightBinningInput> inputs;
+    inputs.clear();
+    for (size_t i = 0; i < gpuLights.size(); ++i) {
+        LightBinningInput input;
+        input.center = glm::vec3(view * glm::vec4(glm::vec3(gpuLights[i].positionBrightness), 1.0f));
+        input.radius = gpuLights[i].attenuation.w;
+
+        float nearDepth = std::max(-input.center.z - input.radius, clusters.nearPlane);
+        float farDepth = std::min(-input.center.z + input.radius, clusters.farPlane);
+        if (input.radius <= 0.0f || nearDepth > farDepth) {
+            input.sliceMin = 1;
+            input.sliceMax = 0;
+        }
+        else {
+            input.sliceMin = clusterSliceForDepth(nearDepth);
+            input.sliceMax = clusterSliceForDepth(farDepth);
+            projectedTileRange(input.center.x - input.radius, input.center.x + input.radius, projection[0][0], nearDepth, farDepth, CLUSTER_TILES_X, input.tileMinX, input.tileMaxX);
+            projectedTileRange(input.center.y - input.radius, input.center.y + input.radius, projection[1][1], nearDepth, farDepth, CLUSTER_TILES_Y, input.tileMinY, input.tileMaxY);
+        }
+        inputs.push_back(input);
+    }
 
-            if (mesh->HasNormals()) {
-                vertices[i * 6 + 3] = mesh->mNormals[i].x;
-                vertices[i * 6 + 4] = mesh->mNormals[i].y;
-                vertices[i * 6 + 5] = mesh->mNormals[i].z;
-            } else {
-                vertices[i * 6 + 3] = vertices[i * 6 + 4] = vertices[i * 6 + 5] = 0.0f;
+    // Every slice owns a disjoint set of clusters, so slices can be binned in parallel without locking
+    auto binSlice = [&](size_t slice) {
+        int z = static_cast<int>(slice);
+        for (unsigned int tile = 0; tile < CLUSTER_TILES_X * CLUSTER_TILES_Y; ++tile) {
+            clusters.clusterLights[z * CLUSTER_TILES_X * CLUSTER_TILES_Y + tile].clear();
+        }
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            const LightBinningInput& input = inputs[i];
+            if (z < input.sliceMin || z > input.sliceMax) continue;
+
+            for (int y = input.tileMinY; y <= input.tileMaxY; ++y) {
+                for (int x = input.tileMinX; x <= input.tileMaxX; ++x) {
+                    unsigned int clusterIndex = x + CLUSTER_TILES_X * (y + CLUSTER_TILES_Y * z);
+                    const ClusterAABB& box = clusters.bounds[clusterIndex];
+                    glm::vec3 closest = glm::clamp(input.center, box.boundsMin, box.boundsMax);
+                    glm::vec3 offset = closest - input.center;
+                    if (glm::dot(offset, offset) <= input.radius * input.radius) {
+                        clusters.clusterLights[clusterIndex].push_back(static_cast<unsigned int>(i));
+                    }
+                }
             }
         }
+    };
+    if (inputs.size() >= PARALLEL_LIGHT_BINNING_THRESHOLD) frameWorkers.parallelFor(CLUSTER_SLICES, binSlice);
+    else for (unsigned int z = 0; z < CLUSTER_SLICES; ++z) binSlice(z);
+
+    clusters.lightIndices.clear();
+    clusters.maxLightsPerCluster = 0;
+    for (unsigned int i = 0; i < CLUSTER_COUNT; ++i) {
+        const std::vector<unsigned int>& lights = clusters.clusterLights[i];
+        clusters.grid[i * 2 + 0] = static_cast<unsigned int>(clusters.lightIndices.size());
+        clusters.grid[i * 2 + 1] = static_cast<unsigned int>(lights.size());
+        clusters.lightIndices.insert(clusters.lightIndices.end(), lights.begin(), lights.end());
+        clusters.maxLightsPerCluster = std::max(clusters.maxLightsPerCluster, static_cast<unsigned int>(lights.size()));
+    }
+    uploadTextureBuffer(clusters.gridBuffer, clusters.grid.data(), clusters.grid.size() * sizeof(unsigned int));
+    uploadTextureBuffer(clusters.indexBuffer, clusters.lightIndices.data(), clusters.lightIndices.size() * sizeof(unsigned int));
+
+    LightBlockData data;
+    data.clusterDimensions = glm::uvec4(CLUSTER_TILES_X, CLUSTER_TILES_Y, CLUSTER_SLICES, static_cast<unsigned int>(gpuLights.size()));
+    float sliceScale = CLUSTER_SLICES / std::log(clusters.farPlane / clusters.nearPlane);
+    data.clusterParams = glm::vec4(static_cast<float>(clusters.width) / CLUSTER_TILES_X, static_cast<float>(clusters.height) / CLUSTER_TILES_Y,
+        sliceScale, sliceScale * std::log(clusters.nearPlane));
+    glBindBuffer(GL_UNIFORM_BUFFER, lightUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(data), &data);
+    frameStats.bytesUploaded += sizeof(data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    glActiveTexture(GL_TEXTURE0 + LIGHT_DATA_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, clusters.lightDataTexture);
+    glActiveTexture(GL_TEXTURE0 + CLUSTER_GRID_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, clusters.gridTexture);
+    glActiveTexture(GL_TEXTURE0 + CLUSTER_LIGHT_INDEX_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, clusters.indexTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
 
-        for (unsigned int i = 0; i < mesh->mNumFaces; ++i) {
-            aiFace face = mesh->mFaces[i];
-            for (unsigned int j = 0; j < face.mNumIndices; ++j) {
-                indices.push_back(face.mIndices[j]);
+void updateLightBuffer() {
+    if (!sceneLightsDirty) return;
+
+    std::vector<LightInstance> instances(sceneLights.size());
+    for (size_t i = 0; i < sceneLights.size(); i++) {
+        instances[i].model = glm::scale(glm::translate(glm::mat4(1.0f), sceneLights[i].position), glm::vec3(0.2f));
+        instances[i].color = sceneLights[i].color;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, lightInstanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(LightInstance), instances.data(), GL_DYNAMIC_DRAW);
+    frameStats.bytesUploaded += instances.size() * sizeof(LightInstance);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    lightInstanceCount = static_cast<GLsizei>(instances.size());
+
+    gpuLights.resize(sceneLights.size());
+    for (size_t i = 0; i < sceneLights.size(); i++) {
+        const Light& light = sceneLights[i];
+        gpuLights[i].positionBrightness = glm::vec4(light.position, light.brightness);
+        gpuLights[i].directionCutOff = glm::vec4(light.direction, glm::cos(glm::radians(light.cutOff)));
+        gpuLights[i].colorOuterCutOff = glm::vec4(light.color, glm::cos(glm::radians(light.outerCutOff)));
+        gpuLights[i].attenuation = glm::vec4(LIGHT_ATTENUATION, computeLightRange(light));
+    }
+    uploadTextureBuffer(lightClusters.lightDataBuffer, gpuLights.data(), gpuLights.size() * sizeof(GpuLight));
+    sceneLightsDirty = false;
+}
+
+const int SHADOW_ATLAS_SIZE = 4096;
+const int MIN_SHADOW_TILE_SIZE = 64, MAX_SHADOW_TILE_SIZE = 1024;
+const float SHADOW_NEAR_PLANE = 0.1f;
+// How far past the rounding point, in octaves, a light's ideal tile size must move before its tile is resized
+const float SHADOW_RESIZE_HYSTERESIS = 0.25f;
+const GLint SHADOW_ATLAS_TEXTURE_UNIT = 7, SHADOW_DATA_TEXTURE_UNIT = 8;
+
+// Perspective frustum over the outer cone out to the light's range; false for lights that cannot cast a shadow
+bool spotLightViewProjection(const Light& light, glm::mat4& viewProjection) {
+    float range = computeLightRange(light);
+    float directionLength = glm::length(light.direction);
+    if (range <= SHADOW_NEAR_PLANE || directionLength < 1e-4f) return false;
+
+    glm::vec3 direction = light.direction / directionLength;
+    glm::vec3 up = std::fabs(direction.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    float fieldOfView = glm::clamp(2.0f * light.outerCutOff, 1.0f, 170.0f);
+    viewProjection = glm::perspective(glm::radians(fieldOfView), 1.0f, SHADOW_NEAR_PLANE, range) * glm::lookAt(light.position, light.position + direction, up);
+    return true;
+}
+
+unsigned int compactMortonBits(unsigned int bits) {
+    bits &= 0x55555555u;
+    bits = (bits | (bits >> 1)) & 0x33333333u;
+    bits = (bits | (bits >> 2)) & 0x0F0F0F0Fu;
+    bits = (bits | (bits >> 4)) & 0x00FF00FFu;
+    bits = (bits | (bits >> 8)) & 0x0000FFFFu;
+    return bits;
+}
+
+// Spotlight shadow maps packed into one depth atlas. Each light's tile is sized by how large its range appears
+// on screen, and is re-rendered only when the light, its tile or the set and transforms of the casters inside
+// its frustum change. Casters are only culled again after something in the scene moved, was added or was removed,
+// so a static scene costs no per-object work for any number of lights.
+class ShadowAtlas {
+public:
+    ShadowAtlas() : depthTexture(0), framebuffer(0), dataBuffer(0), dataTexture(0), dataDirty(true), tileLayoutVersion(0) {}
+
+    bool setup() {
+        glGenTextures(1, &depthTexture);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (!complete) std::cerr << "Shadow atlas framebuffer is incomplete!" << std::endl;
+
+        dataTexture = createBufferTexture(dataBuffer, GL_RGBA32F);
+        return complete;
+    }
+
+    // Resizes tiles to their on-screen budget, re-renders the stale ones and binds the atlas for the lit pass
+    void update(const ShaderProgram& shadowShader, const Frustum& viewFrustum, float pixelsPerUnit, bool enabled) {
+        // Tiles follow the dense light order, which a removal shuffles, so start over when it changes
+        if (sceneLights.layoutVersion() != tileLayoutVersion) {
+            tiles.clear();
+            tileLayoutVersion = sceneLights.layoutVersion();
+        }
+        if (tiles.size() != sceneLights.size()) {
+            tiles.resize(sceneLights.size());
+            dataDirty = true;
+        }
+
+        bool resized = false;
+        priorities.assign(tiles.size(), 0.0f);
+        for (size_t i = 0; i < tiles.size(); ++i) {
+            ShadowTile& tile = tiles[i];
+            const Light& light = sceneLights[i];
+            int requestedSize = 0;
+            tile.hasFrustum = spotLightViewProjection(light, tile.lightViewProjection);
+
+            float range = computeLightRange(light);
+            if (enabled && light.castsShadows && tile.hasFrustum && sphereInFrustum(viewFrustum, light.position, range)) {
+                // Diameter of the light's range on screen, capped at the full view when the camera is inside it
+                float distance = std::max(glm::length(light.position - cameraPos), range);
+                priorities[i] = 2.0f * range / distance * pixelsPerUnit;
+                float octave = std::log2(std::max(priorities[i], 1.0f));
+
+                int currentOctave = tile.requestedSize > 0 ? static_cast<int>(std::log2(static_cast<float>(tile.requestedSize))) : -1;
+                if (currentOctave >= 0 && std::fabs(octave - currentOctave) < 0.5f + SHADOW_RESIZE_HYSTERESIS) requestedSize = tile.requestedSize;
+                else requestedSize = std::min(std::max(1 << static_cast<int>(std::floor(octave + 0.5f)), MIN_SHADOW_TILE_SIZE), MAX_SHADOW_TILE_SIZE);
+            }
+            if (requestedSize != tile.requestedSize) {
+                tile.requestedSize = requestedSize;
+                resized = true;
+            }
+        }
+        if (resized) repack();
+
+        sceneObjects.updateTransforms();
+        const BoundsTable& casterBounds = sceneObjects.bounds();
+
+        bool rendering = false;
+        for (size_t i = 0; i < tiles.size(); ++i) {
+            ShadowTile& tile = tiles[i];
+            if (tile.size == 0) continue;
+
+            bool lightMoved = memcmp(&tile.lightViewProjection, &tile.renderedViewProjection, sizeof(glm::mat4)) != 0;
+            bool sceneChanged = sceneObjects.transformEpoch() != tile.casterEpoch || sceneObjects.layoutVersion() != tile.casterLayoutVersion;
+            if (tile.rendered && !lightMoved && !sceneChanged) continue;
+
+            cullBoundingSpheres(extractFrustum(tile.lightViewProjection), casterBounds, casterVisible);
+            casters.clear();
+            uint64_t signature = 14695981039346656037ull;
+            auto mix = [&signature](uint64_t value) {
+                signature ^= value;
+                signature *= 1099511628211ull;
+            };
+            for (size_t object = 0; object < sceneObjects.size(); ++object) {
+                const std::shared_ptr<MeshAsset>& mesh = sceneObjects.meshes[object];
+                if (!casterVisible[object] || !mesh || mesh->indexCount == 0) continue;
+                casters.push_back(static_cast<uint32_t>(object));
+                // Hash the handle rather than the dense index, which changes when another object is removed
+                EntityHandle handle = sceneObjects.handle(object);
+                mix((uint64_t(handle.generation) << 32) | handle.slot);
+                mix(reinterpret_cast<uintptr_t>(mesh.get()));
+                mix(sceneObjects.revision(object));
+            }
+
+            tile.casterEpoch = sceneObjects.transformEpoch();
+            tile.casterLayoutVersion = sceneObjects.layoutVersion();
+            if (tile.rendered && !lightMoved && signature == tile.casterSignature) continue;
+
+            if (!rendering) {
+                beginRendering();
+                rendering = true;
+            }
+            renderTile(shadowShader, tile, sceneLights[i].position);
+            tile.renderedViewProjection = tile.lightViewProjection;
+            tile.casterSignature = signature;
+            tile.rendered = true;
+            dataDirty = true;
+            frameStats.shadowMapsRendered++;
+        }
+        if (rendering) endRendering();
+
+        if (dataDirty) uploadShadowData();
+
+        glActiveTexture(GL_TEXTURE0 + SHADOW_ATLAS_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glActiveTexture(GL_TEXTURE0 + SHADOW_DATA_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_BUFFER, dataTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    size_t shadowedLightCount() const {
+        size_t count = 0;
+        for (const ShadowTile& tile : tiles) count += tile.size > 0 ? 1 : 0;
+        return count;
+    }
+
+    // Edge length in texels of the light's tile, 0 if it has none this frame
+    int tileSize(size_t light) const { return light < tiles.size() ? tiles[light].size : 0; }
+
+private:
+    struct ShadowTile {
+        int x, y, size;
+        int requestedSize;
+        bool hasFrustum, rendered;
+        glm::mat4 lightViewProjection, renderedViewProjection;
+        uint64_t casterSignature;
+        // Scene state the signature was computed for; while both match, the casters cannot have changed
+        uint64_t casterEpoch, casterLayoutVersion;
+        ShadowTile()
+            : x(0), y(0), size(0), requestedSize(0), hasFrustum(false), rendered(false),
+            lightViewProjection(1.0f), renderedViewProjection(1.0f), casterSignature(0), casterEpoch(0), casterLayoutVersion(0) {}
+    };
+
+    // Power-of-two tiles placed largest first along a Morton curve, so each one lands on an aligned square of its
+    // own size. When the requests overflow the atlas the largest tiles are halved, and at the minimum size the
+    // lights that look smallest on screen go without a shadow.
+    void repack() {
+        order.clear();
+        for (size_t i = 0; i < tiles.size(); ++i) {
+            if (tiles[i].requestedSize > 0) order.push_back(i);
+        }
+        std::vector<int> sizes(tiles.size(), 0);
+        uint64_t area = 0;
+        for (size_t i : order) {
+            sizes[i] = tiles[i].requestedSize;
+            area += uint64_t(sizes[i]) * sizes[i];
+        }
+
+        const uint64_t capacity = uint64_t(SHADOW_ATLAS_SIZE) * SHADOW_ATLAS_SIZE;
+        while (area > capacity) {
+            int largest = 0;
+            for (size_t i : order) largest = std::max(largest, sizes[i]);
+            if (largest > MIN_SHADOW_TILE_SIZE) {
+                for (size_t i : order) {
+                    if (sizes[i] != largest) continue;
+                    sizes[i] /= 2;
+                    area -= uint64_t(largest) * largest * 3 / 4;
+                }
+                continue;
             }
+            auto smallest = std::min_element(order.begin(), order.end(), [&](size_t a, size_t b) { return priorities[a] < priorities[b]; });
+            sizes[*smallest] = 0;
+            area -= uint64_t(MIN_SHADOW_TILE_SIZE) * MIN_SHADOW_TILE_SIZE;
+            order.erase(smallest);
+        }
+
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+        std::vector<glm::ivec2> corners(tiles.size(), glm::ivec2(0));
+        unsigned int cell = 0;
+        for (size_t i : order) {
+            corners[i] = glm::ivec2(static_cast<int>(compactMortonBits(cell)), static_cast<int>(compactMortonBits(cell >> 1))) * MIN_SHADOW_TILE_SIZE;
+            unsigned int cellsPerSide = static_cast<unsigned int>(sizes[i] / MIN_SHADOW_TILE_SIZE);
+            cell += cellsPerSide * cellsPerSide;
+        }
+
+        for (size_t i = 0; i < tiles.size(); ++i) {
+            ShadowTile& tile = tiles[i];
+            if (tile.x == corners[i].x && tile.y == corners[i].y && tile.size == sizes[i]) continue;
+            tile.x = corners[i].x;
+            tile.y = corners[i].y;
+            tile.size = sizes[i];
+            tile.rendered = false;
+            dataDirty = true;
         }
+    }
+
+    void beginRendering() {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glEnable(GL_DEPTH_TEST);
+        glDisable(GL_STENCIL_TEST);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glEnable(GL_SCISSOR_TEST);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(1.5f, 4.0f);
+    }
+
+    void endRendering() {
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glDisable(GL_SCISSOR_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void renderTile(const ShaderProgram& shadowShader, const ShadowTile& tile, const glm::vec3& lightPosition) {
+        glViewport(tile.x, tile.y, tile.size, tile.size);
+        glScissor(tile.x, tile.y, tile.size, tile.size);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        if (casters.empty()) return;
+
+        glUseProgram(shadowShader.id);
+        frameStats.stateChanges++;
+        glUniformMatrix4fv(shadowShader.location(Uniform::LIGHT_VIEW_PROJECTION), 1, GL_FALSE, glm::value_ptr(tile.lightViewProjection));
+        renderer.render(casters, shadowShader, lightPosition);
+    }
+
+    // The tile's scale and offset are folded into each light's matrix; the bounds are inset by half a texel so
+    // the filter never reads a neighbouring tile
+    void uploadShadowData() {
+        shadowData.assign(tiles.size() * 5, glm::vec4(-1.0f));
+        for (size_t i = 0; i < tiles.size(); ++i) {
+            const ShadowTile& tile = tiles[i];
+            if (tile.size == 0 || !tile.rendered) continue;
+
+            float scale = static_cast<float>(tile.size) / SHADOW_ATLAS_SIZE;
+            glm::vec2 offset = glm::vec2(static_cast<float>(tile.x), static_cast<float>(tile.y)) / static_cast<float>(SHADOW_ATLAS_SIZE);
+            glm::mat4 toAtlas = glm::translate(glm::mat4(1.0f), glm::vec3(offset + glm::vec2(0.5f * scale), 0.5f));
+            toAtlas = glm::scale(toAtlas, glm::vec3(0.5f * scale, 0.5f * scale, 0.5f)) * tile.renderedViewProjection;
+
+            for (int column = 0; column < 4; ++column) shadowData[i * 5 + column] = toAtlas[column];
+            float halfTexel = 0.5f / SHADOW_ATLAS_SIZE;
+            shadowData[i * 5 + 4] = glm::vec4(offset + glm::vec2(halfTexel), offset + glm::vec2(scale - halfTexel));
+        }
+        uploadTextureBuffer(dataBuffer, shadowData.data(), shadowData.size() * sizeof(glm::vec4));
+        dataDirty = false;
+    }
+
+    GLuint depthTexture, framebuffer;
+    GLuint dataBuffer, dataTexture;
+    bool dataDirty;
+    std::vector<ShadowTile> tiles;
+    std::vector<float> priorities;
+    std::vector<size_t> order;
+    std::vector<glm::vec4> shadowData;
+    uint64_t tileLayoutVersion;
+    std::vector<unsigned char> casterVisible;
+    std::vector<uint32_t> casters;
+    Renderer renderer;
+};
+
+ShadowAtlas shadowAtlas;
+bool shadowsEnabled = true;
+
+glm::mat4 positionDecodeMatrix(const MeshBounds& bounds) {
+    glm::mat4 decode = glm::translate(glm::mat4(1.0f), bounds.boundsMin);
+    return glm::scale(decode, bounds.boundsMax - bounds.boundsMin);
+}
+
+uint16_t quantizeUnorm16(float value, float minValue, float extent) {
+    if (extent <= 0.0f) return 0;
+    float normalized = std::min(std::max((value - minValue) / extent, 0.0f), 1.0f);
+    return static_cast<uint16_t>(normalized * 65535.0f + 0.5f);
+}
+
+int16_t quantizeSnorm16(float value) {
+    float clamped = std::min(std::max(value, -1.0f), 1.0f);
+    return static_cast<int16_t>(clamped * 32767.0f + (clamped >= 0.0f ? 0.5f : -0.5f));
+}
+
+glm::vec2 encodeOctahedral(const glm::vec3& normal) {
+    float length = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+    if (length == 0.0f) return glm::vec2(0.0f);
 
-        ImportedObject newObject;
-        glGenVertexArrays(1, &newObject.VAO);
-        glGenBuffers(1, &newObject.VBO);
-        glGenBuffers(1, &newObject.EBO);
+    glm::vec2 encoded(normal.x / length, normal.y / length);
+    if (normal.z < 0.0f) {
+        glm::vec2 folded((1.0f - std::fabs(encoded.y)) * (encoded.x >= 0.0f ? 1.0f : -1.0f),
+            (1.0f - std::fabs(encoded.x)) * (encoded.y >= 0.0f ? 1.0f : -1.0f));
+        encoded = folded;
+    }
+    return encoded;
+}
 
-        glBindVertexArray(newObject.VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, newObject.VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+CompactVertex packCompactVertex(const glm::vec3& position, const glm::vec3& normal, const MeshBounds& bounds) {
+    glm::vec3 extent = bounds.boundsMax - bounds.boundsMin;
+    glm::vec2 octahedral = encodeOctahedral(normal);
+
+    CompactVertex vertex;
+    vertex.position[0] = quantizeUnorm16(position.x, bounds.boundsMin.x, extent.x);
+    vertex.position[1] = quantizeUnorm16(position.y, bounds.boundsMin.y, extent.y);
+    vertex.position[2] = quantizeUnorm16(position.z, bounds.boundsMin.z, extent.z);
+    vertex.position[3] = 0;
+    vertex.normal[0] = quantizeSnorm16(octahedral.x);
+    vertex.normal[1] = quantizeSnorm16(octahedral.y);
+    return vertex;
+}
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, newObject.EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+glm::vec3 unpackCompactPosition(const CompactVertex& vertex, const MeshBounds& bounds) {
+    glm::vec3 normalized(vertex.position[0] / 65535.0f, vertex.position[1] / 65535.0f, vertex.position[2] / 65535.0f);
+    return bounds.boundsMin + normalized * (bounds.boundsMax - bounds.boundsMin);
+}
 
+void setupMeshVertexAttributes(VertexFormat format) {
+    if (format == VertexFormat::COMPACT) {
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, position));
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, normal));
+    }
+    else {
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(0);
         glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-        glEnableVertexAttribArray(1);
+    }
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+}
+
+// Best-fit free list over [0, capacity) in whole units. Free blocks are indexed by offset, to merge neighbours
+// on release, and by size, to find the smallest block that fits
+class RangeAllocator {
+public:
+    RangeAllocator() : capacityUnits(0), usedUnits(0) {}
+
+    bool allocate(size_t units, size_t& offset) {
+        auto block = freeBySize.lower_bound(units);
+        if (block == freeBySize.end()) return false;
+        offset = block->second;
+        take(offset, units);
+        return true;
+    }
+
+    // Lowest-addressed block that fits entirely below limit; used to move allocations down when compacting
+    bool allocateBelow(size_t units, size_t limit, size_t& offset) {
+        for (auto block = freeByOffset.begin(); block != freeByOffset.end() && block->first + units <= limit; ++block) {
+            if (block->second < units) continue;
+            offset = block->first;
+            take(offset, units);
+            return true;
+        }
+        return false;
+    }
+
+    void release(size_t offset, size_t units) {
+        usedUnits -= units;
+        addFree(offset, units);
+    }
+
+    void grow(size_t newCapacity) {
+        addFree(capacityUnits, newCapacity - capacityUnits);
+        capacityUnits = newCapacity;
+    }
+
+    // Cuts the capacity back to newCapacity; only valid when everything above it is free
+    void shrink(size_t newCapacity) {
+        auto tail = freeByOffset.upper_bound(newCapacity);
+        if (tail != freeByOffset.begin()) --tail;
+        size_t start = tail->first;
+        removeFree(tail);
+        capacityUnits = newCapacity;
+        if (start < newCapacity) addFree(start, newCapacity - start);
+    }
+
+    // Where the free block that reaches the end of the range starts, or capacity if the last unit is in use
+    size_t tailStart() const {
+        if (freeByOffset.empty()) return capacityUnits;
+        auto last = std::prev(freeByOffset.end());
+        return last->first + last->second == capacityUnits ? last->first : capacityUnits;
+    }
+
+    size_t capacity() const { return capacityUnits; }
+    size_t used() const { return usedUnits; }
+    size_t freeBlocks() const { return freeByOffset.size(); }
+    size_t largestFree() const { return freeBySize.empty() ? 0 : freeBySize.rbegin()->first; }
+
+    // 0 when all free space is one block, approaching 1 as it splinters
+    float fragmentation() const {
+        size_t freeUnits = capacityUnits - usedUnits;
+        return freeUnits == 0 ? 0.0f : 1.0f - float(largestFree()) / float(freeUnits);
+    }
+
+private:
+    // Carves units from the start of the free block at offset
+    void take(size_t offset, size_t units) {
+        auto block = freeByOffset.find(offset);
+        size_t blockUnits = block->second;
+        removeFree(block);
+        if (blockUnits > units) addFree(offset + units, blockUnits - units);
+        usedUnits += units;
+    }
+
+    void addFree(size_t offset, size_t units) {
+        if (units == 0) return;
+        auto next = freeByOffset.lower_bound(offset);
+        if (next != freeByOffset.end() && offset + units == next->first) {
+            units += next->second;
+            next = removeFree(next);
+        }
+        if (next != freeByOffset.begin()) {
+            auto previous = std::prev(next);
+            if (previous->first + previous->second == offset) {
+                offset = previous->first;
+                units += previous->second;
+                removeFree(previous);
+            }
+        }
+        freeByOffset[offset] = units;
+        freeBySize.insert(std::make_pair(units, offset));
+    }
+
+    std::map<size_t, size_t>::iterator removeFree(std::map<size_t, size_t>::iterator block) {
+        auto sized = freeBySize.equal_range(block->second);
+        for (auto it = sized.first; it != sized.second; ++it) {
+            if (it->second == block->first) {
+                freeBySize.erase(it);
+                break;
+            }
+        }
+        return freeByOffset.erase(block);
+    }
+
+    size_t capacityUnits, usedUnits;
+    std::map<size_t, size_t> freeByOffset;
+    std::multimap<size_t, size_t> freeBySize;
+};
+
+const size_t MESH_POOL_MIN_BYTES = 8 * 1024 * 1024;
+// Compaction starts when more than this share of a buffer's free space is outside its largest free block
+const float MESH_POOL_DEFRAG_THRESHOLD = 0.25f;
+const size_t MESH_POOL_DEFRAG_BYTES_PER_FRAME = 4 * 1024 * 1024;
+
+// Vertex and index storage for every imported mesh, sub-allocated from one vertex buffer and one index buffer
+// per vertex format instead of three GL objects per mesh. Meshes of a format share a VAO and are drawn with a
+// base vertex and an index offset. Buffers grow by doubling, ranges of released meshes are reused, and when
+// the free space splinters defragment() moves the highest allocations down into the lowest holes with GPU-side
+// copies, a few megabytes per frame, then gives the unused tail of the buffer back.
+class MeshBufferPool {
+public:
+    struct HeapStats {
+        size_t capacityBytes, usedBytes, freeBlocks, largestFreeBytes;
+        float fragmentation;
+    };
+
+    MeshBufferPool() : nextDrawId(0), layoutRevision(1), moveRevision(0) {}
+
+    // Gives the mesh its ranges and the pool VAO; its data is then uploaded into vertexBuffer() and indexBuffer()
+    void allocate(MeshAsset& mesh) {
+        FormatPool& pool = formatPool(mesh.vertexFormat);
+        if (!pool.VAO) setupFormat(mesh.vertexFormat);
+        mesh.vertexOffset = allocateRange(pool, pool.vertices, mesh.vertexBytes, &mesh);
+        mesh.indexOffset = allocateRange(pool, pool.indices, mesh.indexBytes, &mesh);
+        mesh.VAO = pool.VAO;
+        mesh.drawId = (mesh.vertexFormat == VertexFormat::COMPACT ? 0x80000000u : 0u) | (nextDrawId++ & 0x7FFFFFFFu);
+    }
+
+    void release(MeshAsset& mesh) {
+        if (!mesh.VAO) return;
+        FormatPool& pool = formatPool(mesh.vertexFormat);
+        releaseRange(pool.vertices, mesh.vertexOffset, mesh.vertexBytes);
+        releaseRange(pool.indices, mesh.indexOffset, mesh.indexBytes);
+        mesh.VAO = 0;
+        mesh.vertexOffset = mesh.indexOffset = 0;
+        movedMeshList.erase(std::remove(movedMeshList.begin(), movedMeshList.end(), &mesh), movedMeshList.end());
+        layoutRevision++;
+    }
+
+    GLuint vertexBuffer(VertexFormat format) { return formatPool(format).vertices.buffer; }
+    GLuint indexBuffer(VertexFormat format) { return formatPool(format).indices.buffer; }
+
+    // Changes whenever a mesh's ranges are released, so tables indexed by live meshes must be rebuilt
+    uint64_t revision() const { return layoutRevision; }
+
+    // Meshes whose ranges the last defragment() moved, so copies of just their offsets can be patched. A caller
+    // that skipped a change of movesRevision() has missed some moves and must rebuild instead
+    const std::vector<MeshAsset*>& movedMeshes() const { return movedMeshList; }
+    uint64_t movesRevision() const { return moveRevision; }
+
+    void defragment(size_t budgetBytes) {
+        movedMeshList.clear();
+        for (FormatPool& pool : pools) {
+            if (!pool.VAO) continue;
+            compact(pool, pool.vertices, budgetBytes);
+            compact(pool, pool.indices, budgetBytes);
+        }
+        if (!movedMeshList.empty()) moveRevision++;
+    }
+
+    // Heaps in the order float vertices, float indices, compact vertices, compact indices
+    HeapStats stats(int heap) const {
+        const Heap& h = heap & 1 ? pools[heap / 2].indices : pools[heap / 2].vertices;
+        HeapStats result;
+        result.capacityBytes = h.allocator.capacity() * h.unitBytes;
+        result.usedBytes = h.allocator.used() * h.unitBytes;
+        result.freeBlocks = h.allocator.freeBlocks();
+        result.largestFreeBytes = h.allocator.largestFree() * h.unitBytes;
+        result.fragmentation = h.allocator.fragmentation();
+        return result;
+    }
+
+private:
+    struct Heap {
+        GLuint buffer;
+        // Allocation granularity: the vertex stride, so every range starts on a whole vertex, or 4 bytes for indices
+        size_t unitBytes;
+        RangeAllocator allocator;
+        // Which mesh owns the range starting at each unit offset, so compaction can update it
+        std::map<size_t, MeshAsset*> owners;
+        bool compacting;
+        Heap() : buffer(0), unitBytes(4), compacting(false) {}
+    };
+
+    struct FormatPool {
+        GLuint VAO;
+        Heap vertices, indices;
+        FormatPool() : VAO(0) {}
+    };
+
+    FormatPool& formatPool(VertexFormat format) { return pools[format == VertexFormat::COMPACT ? 1 : 0]; }
+
+    void setupFormat(VertexFormat format) {
+        FormatPool& pool = formatPool(format);
+        pool.vertices.unitBytes = vertexStride(format);
+        pool.indices.unitBytes = sizeof(unsigned int);
+        glGenVertexArrays(1, &pool.VAO);
+        resize(pool, pool.vertices, MESH_POOL_MIN_BYTES / pool.vertices.unitBytes);
+        resize(pool, pool.indices, MESH_POOL_MIN_BYTES / pool.indices.unitBytes);
+    }
+
+    static bool isVertexHeap(const FormatPool& pool, const Heap& heap) { return &heap == &pool.vertices; }
+
+    size_t allocateRange(FormatPool& pool, Heap& heap, size_t bytes, MeshAsset* owner) {
+        size_t units = (bytes + heap.unitBytes - 1) / heap.unitBytes;
+        if (units == 0) return 0;
+
+        size_t offset;
+        while (!heap.allocator.allocate(units, offset)) {
+            resize(pool, heap, std::max(heap.allocator.capacity() * 2, heap.allocator.capacity() + units));
+        }
+        heap.owners[offset] = owner;
+        return offset * heap.unitBytes;
+    }
+
+    void releaseRange(Heap& heap, size_t byteOffset, size_t bytes) {
+        size_t units = (bytes + heap.unitBytes - 1) / heap.unitBytes;
+        if (units == 0) return;
+        heap.allocator.release(byteOffset / heap.unitBytes, units);
+        heap.owners.erase(byteOffset / heap.unitBytes);
+    }
+
+    // Replaces the heap's buffer with one of newCapacity units, keeping everything below the new end
+    void resize(FormatPool& pool, Heap& heap, size_t newCapacity) {
+        size_t keptBytes = std::min(heap.allocator.capacity(), newCapacity) * heap.unitBytes;
+        GLuint replacement;
+        glGenBuffers(1, &replacement);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, replacement);
+        glBufferData(GL_COPY_WRITE_BUFFER, newCapacity * heap.unitBytes, nullptr, GL_STATIC_DRAW);
+        if (heap.buffer) {
+            glBindBuffer(GL_COPY_READ_BUFFER, heap.buffer);
+            if (keptBytes) glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, keptBytes);
+            glDeleteBuffers(1, &heap.buffer);
+        }
+        heap.buffer = replacement;
+        if (newCapacity > heap.allocator.capacity()) heap.allocator.grow(newCapacity);
+        else heap.allocator.shrink(newCapacity);
+
+        glBindVertexArray(pool.VAO);
+        if (isVertexHeap(pool, heap)) {
+            glBindBuffer(GL_ARRAY_BUFFER, heap.buffer);
+            setupMeshVertexAttributes(&pool == &pools[1] ? VertexFormat::COMPACT : VertexFormat::FLOAT);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+        else {
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, heap.buffer);
+        }
+        glBindVertexArray(0);
+    }
+
+    // Moves the highest allocations that fit into a lower hole, within budgetBytes. Outside of compaction a heap
+    // using less than a quarter of its buffer is trimmed to twice what it uses
+    void compact(FormatPool& pool, Heap& heap, size_t& budgetBytes) {
+        if (!heap.compacting) heap.compacting = heap.allocator.fragmentation() > MESH_POOL_DEFRAG_THRESHOLD;
+        if (heap.compacting && moveAllocations(pool, heap, budgetBytes)) return;
+        heap.compacting = false;
+
+        size_t target = std::max(MESH_POOL_MIN_BYTES / heap.unitBytes, heap.allocator.used() * 2);
+        if (target < heap.allocator.capacity() / 2 && heap.allocator.tailStart() <= target) resize(pool, heap, target);
+    }
+
+    // Returns false once no allocation can move any lower
+    bool moveAllocations(FormatPool& pool, Heap& heap, size_t& budgetBytes) {
+        bool moved = true;
+        while (moved && budgetBytes > 0) {
+            moved = false;
+            for (auto owner = heap.owners.rbegin(); owner != heap.owners.rend(); ++owner) {
+                MeshAsset& mesh = *owner->second;
+                size_t from = owner->first;
+                size_t bytes = isVertexHeap(pool, heap) ? mesh.vertexBytes : mesh.indexBytes;
+                size_t units = (bytes + heap.unitBytes - 1) / heap.unitBytes;
+                size_t to;
+                if (!heap.allocator.allocateBelow(units, from, to)) continue;
+
+                // Source and destination do not overlap, so one buffer can be both ends of the copy
+                glBindBuffer(GL_COPY_READ_BUFFER, heap.buffer);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, heap.buffer);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, from * heap.unitBytes, to * heap.unitBytes, units * heap.unitBytes);
+                heap.allocator.release(from, units);
+                heap.owners.erase(from);
+                heap.owners[to] = &mesh;
+                (isVertexHeap(pool, heap) ? mesh.vertexOffset : mesh.indexOffset) = to * heap.unitBytes;
+                if (std::find(movedMeshList.begin(), movedMeshList.end(), &mesh) == movedMeshList.end()) movedMeshList.push_back(&mesh);
+
+                budgetBytes -= std::min(budgetBytes, units * heap.unitBytes);
+                moved = true;
+                break;
+            }
+        }
+        return moved;
+    }
+
+    FormatPool pools[2];
+    uint32_t nextDrawId;
+    uint64_t layoutRevision, moveRevision;
+    std::vector<MeshAsset*> movedMeshList;
+};
+
+MeshBufferPool meshBufferPool;
+
+// FIFO post-transform cache size assumed by the reordering and the ACMR report
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+// Average cache miss ratio: transformed vertices per triangle, 0.5 is ideal and 3 is worst case
+float computeACMR(const std::vector<unsigned int>& indices, size_t vertexCount) {
+    if (indices.size() < 3) return 0.0f;
+
+    std::vector<unsigned int> cacheTime(vertexCount, 0);
+    unsigned int timestamp = VERTEX_CACHE_SIZE + 1;
+    size_t misses = 0;
+    for (unsigned int v : indices) {
+        if (timestamp - cacheTime[v] > VERTEX_CACHE_SIZE) {
+            cacheTime[v] = timestamp++;
+            misses++;
+        }
+    }
+    return static_cast<float>(misses) / (indices.size() / 3);
+}
+
+// Merges vertices with bitwise identical position and normal; the orphans are dropped by optimizeVertexFetch
+void weldVertices(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals, std::vector<unsigned int>& indices) {
+    auto compare = [&](unsigned int a, unsigned int b) {
+        int order = memcmp(&positions[a], &positions[b], sizeof(glm::vec3));
+        if (order == 0) order = memcmp(&normals[a], &normals[b], sizeof(glm::vec3));
+        return order;
+    };
+
+    std::vector<unsigned int> sorted(positions.size());
+    for (unsigned int i = 0; i < sorted.size(); ++i) sorted[i] = i;
+    std::sort(sorted.begin(), sorted.end(), [&](unsigned int a, unsigned int b) { return compare(a, b) < 0; });
+
+    std::vector<unsigned int> remap(positions.size());
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        bool duplicate = i > 0 && compare(sorted[i - 1], sorted[i]) == 0;
+        remap[sorted[i]] = duplicate ? remap[sorted[i - 1]] : sorted[i];
+    }
+    for (unsigned int& index : indices) index = remap[index];
+}
+
+// Tipsify (Sander et al. 2007): fans around the vertex that will stay in the cache longest. Records where the
+// walk had to jump to a vertex outside the cache, which splits the output into clusters for the overdraw pass.
+std::vector<unsigned int> optimizeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount, std::vector<size_t>& clusterStarts) {
+    size_t triangleCount = indices.size() / 3;
+
+    std::vector<unsigned int> adjacencyOffsets(vertexCount + 1, 0), adjacency(indices.size());
+    for (unsigned int v : indices) adjacencyOffsets[v + 1]++;
+    for (size_t v = 0; v < vertexCount; ++v) adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+    std::vector<unsigned int> fillOffsets(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i) adjacency[fillOffsets[indices[i]]++] = static_cast<unsigned int>(i / 3);
+
+    std::vector<unsigned int> liveTriangles(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) liveTriangles[v] = adjacencyOffsets[v + 1] - adjacencyOffsets[v];
+
+    std::vector<unsigned int> cacheTime(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<unsigned int> deadEnd, candidates;
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+    clusterStarts.assign(1, 0);
+
+    unsigned int timestamp = VERTEX_CACHE_SIZE + 1;
+    size_t cursor = 0;
+    int64_t fanning = vertexCount > 0 ? 0 : -1;
+
+    while (fanning >= 0) {
+        candidates.clear();
+        for (unsigned int a = adjacencyOffsets[fanning]; a < adjacencyOffsets[fanning + 1]; ++a) {
+            unsigned int triangle = adjacency[a];
+            if (emitted[triangle]) continue;
+
+            for (int corner = 0; corner < 3; ++corner) {
+                unsigned int v = indices[triangle * 3 + corner];
+                result.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+                if (timestamp - cacheTime[v] > VERTEX_CACHE_SIZE) cacheTime[v] = timestamp++;
+            }
+            emitted[triangle] = true;
+        }
+
+        int64_t next = -1;
+        int bestPriority = -1;
+        for (unsigned int v : candidates) {
+            if (liveTriangles[v] == 0) continue;
+            int priority = 0;
+            if (timestamp - cacheTime[v] + 2 * liveTriangles[v] <= VERTEX_CACHE_SIZE) priority = static_cast<int>(timestamp - cacheTime[v]);
+            if (priority > bestPriority) {
+                bestPriority = priority;
+                next = v;
+            }
+        }
+
+        bool cacheFlushed = false;
+        while (next < 0 && !deadEnd.empty()) {
+            unsigned int v = deadEnd.back();
+            deadEnd.pop_back();
+            if (liveTriangles[v] > 0) {
+                next = v;
+                cacheFlushed = timestamp - cacheTime[v] > VERTEX_CACHE_SIZE;
+            }
+        }
+        if (next < 0) {
+            while (cursor < vertexCount && liveTriangles[cursor] == 0) ++cursor;
+            if (cursor < vertexCount) {
+                next = static_cast<int64_t>(cursor);
+                cacheFlushed = true;
+            }
+        }
+
+        if (cacheFlushed && clusterStarts.back() != result.size() / 3) clusterStarts.push_back(result.size() / 3);
+        fanning = next;
+    }
+    return result;
+}
+
+// Draws clusters facing away from the mesh centre first, so they tend to occlude the rest (Sander et al. 2007)
+void optimizeOverdraw(const std::vector<glm::vec3>& positions, std::vector<unsigned int>& indices, const std::vector<size_t>& clusterStarts) {
+    size_t clusterCount = clusterStarts.size();
+    if (clusterCount < 2) return;
+
+    std::vector<glm::vec3> clusterCentroids(clusterCount, glm::vec3(0.0f)), clusterNormals(clusterCount, glm::vec3(0.0f));
+    std::vector<float> clusterAreas(clusterCount, 0.0f);
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+
+    for (size_t cluster = 0; cluster < clusterCount; ++cluster) {
+        size_t end = cluster + 1 < clusterCount ? clusterStarts[cluster + 1] : indices.size() / 3;
+        for (size_t triangle = clusterStarts[cluster]; triangle < end; ++triangle) {
+            const glm::vec3& v0 = positions[indices[triangle * 3 + 0]];
+            const glm::vec3& v1 = positions[indices[triangle * 3 + 1]];
+            const glm::vec3& v2 = positions[indices[triangle * 3 + 2]];
+            glm::vec3 areaNormal = glm::cross(v1 - v0, v2 - v0);
+            float area = glm::length(areaNormal);
+
+            clusterCentroids[cluster] += (v0 + v1 + v2) * (area / 3.0f);
+            clusterNormals[cluster] += areaNormal;
+            clusterAreas[cluster] += area;
+        }
+        meshCentroid += clusterCentroids[cluster];
+        meshArea += clusterAreas[cluster];
+    }
+    if (meshArea <= 0.0f) return;
+    meshCentroid /= meshArea;
+
+    std::vector<float> outwardness(clusterCount, 0.0f);
+    for (size_t cluster = 0; cluster < clusterCount; ++cluster) {
+        float normalLength = glm::length(clusterNormals[cluster]);
+        if (clusterAreas[cluster] <= 0.0f || normalLength <= 0.0f) continue;
+        glm::vec3 centroid = clusterCentroids[cluster] / clusterAreas[cluster];
+        outwardness[cluster] = glm::dot(centroid - meshCentroid, clusterNormals[cluster] / normalLength);
+    }
+
+    std::vector<size_t> order(clusterCount);
+    for (size_t i = 0; i < clusterCount; ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return outwardness[a] > outwardness[b]; });
+
+    std::vector<unsigned int> sorted;
+    sorted.reserve(indices.size());
+    for (size_t cluster : order) {
+        size_t end = cluster + 1 < clusterCount ? clusterStarts[cluster + 1] : indices.size() / 3;
+        sorted.insert(sorted.end(), indices.begin() + clusterStarts[cluster] * 3, indices.begin() + end * 3);
+    }
+    indices.swap(sorted);
+}
+
+// Renumbers vertices in first-use order so vertex fetches walk the buffer linearly, dropping unreferenced ones
+void optimizeVertexFetch(std::vector<glm::vec3>& positions, std::vector<glm::vec3>& normals, std::vector<unsigned int>& indices) {
+    const unsigned int UNUSED = std::numeric_limits<unsigned int>::max();
+    std::vector<unsigned int> remap(positions.size(), UNUSED);
+    unsigned int vertexCount = 0;
+    for (unsigned int& index : indices) {
+        if (remap[index] == UNUSED) remap[index] = vertexCount++;
+        index = remap[index];
+    }
+
+    std::vector<glm::vec3> fetchPositions(vertexCount), fetchNormals(vertexCount);
+    for (size_t v = 0; v < positions.size(); ++v) {
+        if (remap[v] == UNUSED) continue;
+        fetchPositions[remap[v]] = positions[v];
+        fetchNormals[remap[v]] = normals[v];
+    }
+    positions.swap(fetchPositions);
+    normals.swap(fetchNormals);
+}
+
+void optimizeMesh(std::vector<glm::vec3>& positions, std::vector<glm::vec3>& normals, std::vector<unsigned int>& indices) {
+    weldVertices(positions, normals, indices);
+
+    std::vector<size_t> clusterStarts;
+    indices = optimizeVertexCache(indices, positions.size(), clusterStarts);
+    optimizeOverdraw(positions, indices, clusterStarts);
+    optimizeVertexFetch(positions, normals, indices);
+}
+
+struct Quadric {
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2, weight;
+    Quadric() : a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0), weight(0) {}
+
+    // Plane n.p + d = 0 with unit normal n
+    Quadric(const glm::vec3& n, float d, double planeWeight)
+        : a2(planeWeight * n.x * n.x), ab(planeWeight * n.x * n.y), ac(planeWeight * n.x * n.z), ad(planeWeight * n.x * d),
+        b2(planeWeight * n.y * n.y), bc(planeWeight * n.y * n.z), bd(planeWeight * n.y * d),
+        c2(planeWeight * n.z * n.z), cd(planeWeight * n.z * d), d2(planeWeight * d * d), weight(planeWeight) {}
+
+    Quadric& operator+=(const Quadric& q) {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+        b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd; d2 += q.d2;
+        weight += q.weight;
+        return *this;
+    }
+
+    // Weighted mean squared distance from p to the accumulated planes
+    double error(const glm::vec3& p) const {
+        double x = p.x, y = p.y, z = p.z;
+        double sum = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+            + b2 * y * y + 2 * bc * y * z + 2 * bd * y
+            + c2 * z * z + 2 * cd * z + d2;
+        return weight > 0.0 ? std::max(sum / weight, 0.0) : 0.0;
+    }
+};
+
+const int MAX_MESH_LODS = 4;
+const float LOD_TRIANGLE_RATIO = 0.25f;
+const size_t MIN_LOD_TRIANGLES = 64;
+const float LOD_BOUNDARY_WEIGHT = 10.0f;
+
+// Quadric error metric decimation (Garland & Heckbert 1997) restricted to collapsing an edge onto one of its
+// endpoints, so every level indexes the same vertex buffer. Appends the indices of each coarser level after
+// the full-detail ones; lods[i].error is the geometric deviation of level i in mesh units.
+void buildMeshLods(const std::vector<glm::vec3>& positions, std::vector<unsigned int>& indices, std::vector<MeshLod>& lods) {
+    lods.assign(1, MeshLod(0, static_cast<unsigned int>(indices.size()), 0.0f));
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount < MIN_LOD_TRIANGLES * 2) return;
+
+    // Collapse on position-welded ids so normal seams stay closed
+    std::vector<unsigned int> sorted(positions.size()), canonical(positions.size());
+    for (unsigned int i = 0; i < sorted.size(); ++i) sorted[i] = i;
+    std::sort(sorted.begin(), sorted.end(), [&](unsigned int a, unsigned int b) {
+        return memcmp(&positions[a], &positions[b], sizeof(glm::vec3)) < 0;
+    });
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        bool duplicate = i > 0 && memcmp(&positions[sorted[i - 1]], &positions[sorted[i]], sizeof(glm::vec3)) == 0;
+        canonical[sorted[i]] = duplicate ? canonical[sorted[i - 1]] : sorted[i];
+    }
+
+    std::vector<unsigned int> triangles(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i) triangles[i] = canonical[indices[i]];
+
+    std::vector<Quadric> quadrics(positions.size());
+    std::vector<std::vector<unsigned int>> vertexTriangles(positions.size());
+    std::vector<bool> removed(triangleCount, false);
+    std::vector<std::pair<uint64_t, unsigned int>> edges;
+    edges.reserve(indices.size());
+    size_t liveTriangles = 0;
+
+    for (size_t t = 0; t < triangleCount; ++t) {
+        unsigned int* corners = &triangles[t * 3];
+        glm::vec3 areaNormal = glm::cross(positions[corners[1]] - positions[corners[0]], positions[corners[2]] - positions[corners[0]]);
+        float area = glm::length(areaNormal);
+        if (corners[0] == corners[1] || corners[1] == corners[2] || corners[0] == corners[2] || area <= 0.0f) {
+            removed[t] = true;
+            continue;
+        }
+
+        glm::vec3 normal = areaNormal / area;
+        Quadric plane(normal, -glm::dot(normal, positions[corners[0]]), area * 0.5);
+        for (int c = 0; c < 3; ++c) {
+            quadrics[corners[c]] += plane;
+            vertexTriangles[corners[c]].push_back(static_cast<unsigned int>(t));
+
+            unsigned int a = corners[c], b = corners[(c + 1) % 3];
+            edges.push_back(std::make_pair((uint64_t(std::min(a, b)) << 32) | std::max(a, b), static_cast<unsigned int>(t)));
+        }
+        liveTriangles++;
+    }
+
+    // Open borders get a plane perpendicular to their triangle so they don't shrink inwards
+    std::sort(edges.begin(), edges.end());
+    for (size_t i = 0; i < edges.size();) {
+        size_t j = i + 1;
+        while (j < edges.size() && edges[j].first == edges[i].first) ++j;
+        if (j - i == 1) {
+            unsigned int a = static_cast<unsigned int>(edges[i].first >> 32), b = static_cast<unsigned int>(edges[i].first & 0xFFFFFFFFu);
+            const unsigned int* corners = &triangles[edges[i].second * 3];
+            glm::vec3 faceNormal = glm::cross(positions[corners[1]] - positions[corners[0]], positions[corners[2]] - positions[corners[0]]);
+            glm::vec3 edge = positions[b] - positions[a];
+            glm::vec3 borderNormal = glm::cross(edge, faceNormal);
+            float length = glm::length(borderNormal);
+            if (length > 0.0f) {
+                borderNormal /= length;
+                Quadric border(borderNormal, -glm::dot(borderNormal, positions[a]), LOD_BOUNDARY_WEIGHT * glm::dot(edge, edge));
+                quadrics[a] += border;
+                quadrics[b] += border;
+            }
+        }
+        i = j;
+    }
+
+    struct Collapse {
+        double cost;
+        unsigned int from, to, fromVersion, toVersion;
+        bool operator<(const Collapse& other) const { return cost > other.cost; }
+    };
+    std::priority_queue<Collapse> queue;
+    std::vector<unsigned int> version(positions.size(), 0);
+    std::vector<bool> collapsed(positions.size(), false);
+
+    auto pushEdge = [&](unsigned int a, unsigned int b) {
+        Quadric merged = quadrics[a];
+        merged += quadrics[b];
+        double costToB = merged.error(positions[b]), costToA = merged.error(positions[a]);
+        if (costToB <= costToA) queue.push(Collapse{ costToB, a, b, version[a], version[b] });
+        else queue.push(Collapse{ costToA, b, a, version[b], version[a] });
+    };
+    for (size_t i = 0; i < edges.size(); ++i) {
+        if (i > 0 && edges[i].first == edges[i - 1].first) continue;
+        pushEdge(static_cast<unsigned int>(edges[i].first >> 32), static_cast<unsigned int>(edges[i].first & 0xFFFFFFFFu));
+    }
+
+    // Moving 'from' onto 'to' must not flip or flatten any triangle that survives the collapse
+    auto collapseFlipsTriangle = [&](unsigned int from, unsigned int to) {
+        for (unsigned int t : vertexTriangles[from]) {
+            if (removed[t]) continue;
+            const unsigned int* corners = &triangles[t * 3];
+            if (corners[0] == to || corners[1] == to || corners[2] == to) continue;
+
+            glm::vec3 p[3], q[3];
+            for (int c = 0; c < 3; ++c) {
+                p[c] = positions[corners[c]];
+                q[c] = corners[c] == from ? positions[to] : p[c];
+            }
+            glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+            glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+            if (glm::dot(before, after) <= 0.0f) return true;
+        }
+        return false;
+    };
+
+    size_t target = static_cast<size_t>(triangleCount * LOD_TRIANGLE_RATIO);
+    double maxError = 0.0;
+    std::vector<size_t> clusterStarts;
+
+    while (!queue.empty() && lods.size() < MAX_MESH_LODS && target >= MIN_LOD_TRIANGLES) {
+        Collapse collapse = queue.top();
+        queue.pop();
+        if (collapsed[collapse.from] || collapsed[collapse.to] ||
+            version[collapse.from] != collapse.fromVersion || version[collapse.to] != collapse.toVersion) continue;
+        if (collapseFlipsTriangle(collapse.from, collapse.to)) continue;
+
+        for (unsigned int t : vertexTriangles[collapse.from]) {
+            if (removed[t]) continue;
+            unsigned int* corners = &triangles[t * 3];
+            if (corners[0] == collapse.to || corners[1] == collapse.to || corners[2] == collapse.to) {
+                removed[t] = true;
+                liveTriangles--;
+                continue;
+            }
+            for (int c = 0; c < 3; ++c) {
+                if (corners[c] == collapse.from) corners[c] = collapse.to;
+            }
+            vertexTriangles[collapse.to].push_back(t);
+        }
+        quadrics[collapse.to] += quadrics[collapse.from];
+        collapsed[collapse.from] = true;
+        version[collapse.to]++;
+        maxError = std::max(maxError, collapse.cost);
+
+        std::vector<unsigned int>& neighbours = vertexTriangles[collapse.to];
+        neighbours.erase(std::remove_if(neighbours.begin(), neighbours.end(), [&](unsigned int t) { return removed[t]; }), neighbours.end());
+        for (unsigned int t : neighbours) {
+            for (int c = 0; c < 3; ++c) {
+                unsigned int v = triangles[t * 3 + c];
+                if (v != collapse.to) pushEdge(collapse.to, v);
+            }
+        }
+
+        if (liveTriangles > target) continue;
+
+        std::vector<unsigned int> levelIndices;
+        levelIndices.reserve(liveTriangles * 3);
+        for (size_t t = 0; t < triangleCount; ++t) {
+            if (!removed[t]) levelIndices.insert(levelIndices.end(), &triangles[t * 3], &triangles[t * 3] + 3);
+        }
+        levelIndices = optimizeVertexCache(levelIndices, positions.size(), clusterStarts);
+
+        lods.push_back(MeshLod(static_cast<unsigned int>(indices.size()), static_cast<unsigned int>(levelIndices.size()), static_cast<float>(std::sqrt(maxError))));
+        indices.insert(indices.end(), levelIndices.begin(), levelIndices.end());
+        target = static_cast<size_t>(liveTriangles * LOD_TRIANGLE_RATIO);
+    }
+}
+
+// Assimp's post-processing steps run on the importing thread only, so missing normals are filled in by
+// extractMeshGeometry instead, where the conversion can be split across the import workers
+const unsigned int IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_FlipUVs;
+
+static_assert(sizeof(aiVector3D) == sizeof(glm::vec3), "aiVector3D and glm::vec3 must share a layout for the bulk copies");
+
+// Copies an Assimp mesh into our arrays, keeping only triangles. Meshes without normals get flat face normals
+// written to each corner, the same result aiProcess_GenNormals gives
+void extractMeshGeometry(const aiMesh* mesh, std::vector<glm::vec3>& positions, std::vector<glm::vec3>& normals, std::vector<unsigned int>& indices) {
+    size_t vertexCount = mesh->mNumVertices;
+    positions.resize(vertexCount);
+    normals.assign(vertexCount, glm::vec3(0.0f));
+    importWorkers.parallelForRange(vertexCount, IMPORT_TASK_GRAIN, [&](size_t begin, size_t end) {
+        memcpy(&positions[begin], &mesh->mVertices[begin], (end - begin) * sizeof(glm::vec3));
+        if (mesh->mNormals) memcpy(&normals[begin], &mesh->mNormals[begin], (end - begin) * sizeof(glm::vec3));
+    });
+
+    // Triangulate can leave point and line primitives behind, which the triangle-only paths cannot use
+    if (mesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE) {
+        indices.resize(size_t(mesh->mNumFaces) * 3);
+        importWorkers.parallelForRange(mesh->mNumFaces, IMPORT_TASK_GRAIN, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                const unsigned int* face = mesh->mFaces[i].mIndices;
+                indices[i * 3 + 0] = face[0];
+                indices[i * 3 + 1] = face[1];
+                indices[i * 3 + 2] = face[2];
+            }
+        });
+    }
+    else {
+        indices.clear();
+        indices.reserve(size_t(mesh->mNumFaces) * 3);
+        for (unsigned int i = 0; i < mesh->mNumFaces; ++i) {
+            const aiFace& face = mesh->mFaces[i];
+            if (face.mNumIndices != 3) continue;
+            indices.insert(indices.end(), face.mIndices, face.mIndices + 3);
+        }
+    }
+
+    if (mesh->mNormals) return;
+
+    // A corner shared by several faces takes the normal of the last one, as in Assimp. Face normals and the last
+    // face of each vertex (stored plus one, so 0 means untouched) are found in parallel, then scattered
+    size_t faceCount = indices.size() / 3;
+    std::vector<glm::vec3> faceNormals(faceCount);
+    std::vector<std::atomic<uint32_t>> lastFace(vertexCount);
+    importWorkers.parallelForRange(faceCount, IMPORT_TASK_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t face = begin; face < end; ++face) {
+            const unsigned int* corners = &indices[face * 3];
+            const glm::vec3& a = positions[corners[0]];
+            glm::vec3 normal = glm::cross(positions[corners[1]] - a, positions[corners[2]] - a);
+            float length = glm::length(normal);
+            faceNormals[face] = length > 0.0f ? normal / length : normal;
+
+            uint32_t tag = static_cast<uint32_t>(face + 1);
+            for (int c = 0; c < 3; ++c) {
+                std::atomic<uint32_t>& last = lastFace[corners[c]];
+                uint32_t seen = last.load(std::memory_order_relaxed);
+                while (seen < tag && !last.compare_exchange_weak(seen, tag, std::memory_order_relaxed)) {}
+            }
+        }
+    });
+    importWorkers.parallelForRange(vertexCount, IMPORT_TASK_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t v = begin; v < end; ++v) {
+            uint32_t tag = lastFace[v].load(std::memory_order_relaxed);
+            if (tag) normals[v] = faceNormals[tag - 1];
+        }
+    });
+}
+
+struct ImportSettings {
+    bool compactVertices;
+    bool optimizeMeshes;
+    bool generateLods;
+    bool useMeshCache;
+    ImportSettings() : compactVertices(true), optimizeMeshes(true), generateLods(true), useMeshCache(true) {}
+
+    VertexFormat vertexFormat() const { return compactVertices ? VertexFormat::COMPACT : VertexFormat::FLOAT; }
+
+    // Everything besides the vertex format that changes the processed meshes, recorded in the mesh cache header
+    uint32_t processingFlags() const { return (optimizeMeshes ? 1u : 0u) | (generateLods ? 2u : 0u); }
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+    MappedFile() : mappedData(nullptr), mappedSize(0) {
+#ifdef _WIN32
+        fileHandle = INVALID_HANDLE_VALUE;
+        mappingHandle = nullptr;
+#endif
+    }
+
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+            close();
+            return false;
+        }
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mappingHandle) {
+            close();
+            return false;
+        }
+        mappedData = static_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+        mappedSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat fileInfo;
+        if (fstat(fd, &fileInfo) != 0 || fileInfo.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* address = mmap(nullptr, static_cast<size_t>(fileInfo.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (address == MAP_FAILED) return false;
+
+        mappedData = static_cast<const char*>(address);
+        mappedSize = static_cast<size_t>(fileInfo.st_size);
+#endif
+        if (!mappedData) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (mappedData) UnmapViewOfFile(mappedData);
+        if (mappingHandle) CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+        mappingHandle = nullptr;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (mappedData) munmap(const_cast<char*>(mappedData), mappedSize);
+#endif
+        mappedData = nullptr;
+        mappedSize = 0;
+    }
+
+    const char* data() const { return mappedData; }
+    size_t size() const { return mappedSize; }
+
+    // Asks the kernel to start reading a range in the background so the later copy does not stall on page faults
+    void prefetch(size_t offset, size_t bytes) const { advise(offset, bytes, true); }
+
+    // Drops the pages behind a range once it has been copied out; they are re-read from the file if touched again
+    void release(size_t offset, size_t bytes) const { advise(offset, bytes, false); }
+
+private:
+    void advise(size_t offset, size_t bytes, bool willNeed) const {
+        if (!mappedData || offset >= mappedSize) return;
+        bytes = std::min(bytes, mappedSize - offset);
+#ifdef _WIN32
+        // Windows trims mapped views from the working set on its own and has no portable per-range hint before Windows 8
+        (void)bytes;
+        (void)willNeed;
+#else
+        static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t begin = offset / pageSize * pageSize;
+        madvise(const_cast<char*>(mappedData) + begin, offset + bytes - begin, willNeed ? MADV_WILLNEED : MADV_DONTNEED);
+#endif
+    }
+
+    const char* mappedData;
+    size_t mappedSize;
+#ifdef _WIN32
+    HANDLE fileHandle, mappingHandle;
+#endif
+};
+
+bool getFileModifiedTime(const std::string& path, int64_t& modifiedTime) {
+#ifdef _WIN32
+    struct _stat64 fileInfo;
+    if (_stat64(path.c_str(), &fileInfo) != 0) return false;
+#else
+    struct stat fileInfo;
+    if (stat(path.c_str(), &fileInfo) != 0) return false;
+#endif
+    modifiedTime = static_cast<int64_t>(fileInfo.st_mtime);
+    return true;
+}
+
+bool getFileSize(const std::string& path, uint64_t& size) {
+#ifdef _WIN32
+    struct _stat64 fileInfo;
+    if (_stat64(path.c_str(), &fileInfo) != 0) return false;
+#else
+    struct stat fileInfo;
+    if (stat(path.c_str(), &fileInfo) != 0) return false;
+#endif
+    size = static_cast<uint64_t>(fileInfo.st_size);
+    return true;
+}
+
+uint64_t hashString(const std::string& text) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+const char MESH_CACHE_MAGIC[4] = { 'M', 'S', 'H', 'C' };
+const uint32_t MESH_CACHE_VERSION = 5;
+const char* const MESH_CACHE_DIRECTORY = "meshcache";
+
+// File layout: header, one entry per mesh, the model's node hierarchy, then 16-byte aligned vertex, index and BVH blocks
+struct MeshCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t importFlags;
+    uint32_t meshCount;
+    uint32_t vertexFormat;
+    uint32_t processingFlags;
+    int64_t sourceModifiedTime;
+    uint64_t sourcePathHash;
+    uint32_t nodeCount;
+    uint64_t nodeOffset;
+};
+
+struct MeshCacheEntry {
+    uint32_t vertexCount, vertexStride, indexCount, indexSize, bvhNodeCount, lodCount;
+    float acmrBefore, acmrAfter;
+    MeshBounds bounds;
+    uint64_t vertexOffset, indexOffset, bvhNodeOffset, bvhTriangleOffset, lodOffset;
+};
+
+std::string meshCachePathNextToAsset(const std::string& sourcePath) {
+    return sourcePath + ".meshcache";
+}
+
+std::string meshCachePathInCacheDirectory(const std::string& sourcePath) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hashString(sourcePath)));
+    return std::string(MESH_CACHE_DIRECTORY) + "/" + name + ".meshcache";
+}
+
+std::shared_ptr<MappedFile> openMeshCache(const std::string& sourcePath, int64_t sourceModifiedTime, const ImportSettings& settings) {
+    const std::string candidates[] = { meshCachePathNextToAsset(sourcePath), meshCachePathInCacheDirectory(sourcePath) };
+
+    for (const auto& cachePath : candidates) {
+        auto file = std::make_shared<MappedFile>();
+        if (!file->open(cachePath) || file->size() < sizeof(MeshCacheHeader)) continue;
+
+        MeshCacheHeader header;
+        memcpy(&header, file->data(), sizeof(header));
+        bool valid = memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+            header.version == MESH_CACHE_VERSION &&
+            header.importFlags == IMPORT_FLAGS &&
+            header.vertexFormat == static_cast<uint32_t>(settings.vertexFormat()) &&
+            header.processingFlags == settings.processingFlags() &&
+            header.sourceModifiedTime == sourceModifiedTime &&
+            header.sourcePathHash == hashString(sourcePath) &&
+            file->size() >= sizeof(MeshCacheHeader) + header.meshCount * sizeof(MeshCacheEntry);
+        if (valid) return file;
+    }
+    return nullptr;
+}
+
+// Pads the stream to a 16-byte boundary, writes the block there and returns its offset
+uint64_t writeAlignedBlock(std::ofstream& out, const void* data, size_t bytes) {
+    static const char padding[16] = {};
+    uint64_t offset = static_cast<uint64_t>(out.tellp());
+    size_t misalignment = static_cast<size_t>(offset % 16);
+    if (misalignment) {
+        out.write(padding, 16 - misalignment);
+        offset += 16 - misalignment;
+    }
+    out.write(static_cast<const char*>(data), bytes);
+    return offset;
+}
+
+// Streams meshes into a temporary file as they are converted and only renames it into place once complete
+class MeshCacheWriter {
+public:
+    bool open(const std::string& sourcePath, int64_t sourceModifiedTime, const ImportSettings& settings, uint32_t meshCount, const std::vector<ModelNode>& nodes) {
+        finalPath = meshCachePathNextToAsset(sourcePath);
+        tempPath = finalPath + ".tmp";
+        out.open(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+#ifdef _WIN32
+            _mkdir(MESH_CACHE_DIRECTORY);
+#else
+            mkdir(MESH_CACHE_DIRECTORY, 0755);
+#endif
+            finalPath = meshCachePathInCacheDirectory(sourcePath);
+            tempPath = finalPath + ".tmp";
+            out.clear();
+            out.open(tempPath, std::ios::binary | std::ios::trunc);
+            if (!out) return false;
+        }
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+        header.version = MESH_CACHE_VERSION;
+        header.importFlags = IMPORT_FLAGS;
+        header.meshCount = meshCount;
+        header.vertexFormat = static_cast<uint32_t>(settings.vertexFormat());
+        header.processingFlags = settings.processingFlags();
+        header.sourceModifiedTime = sourceModifiedTime;
+        header.sourcePathHash = hashString(sourcePath);
+        header.nodeCount = static_cast<uint32_t>(nodes.size());
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        entries.assign(meshCount, MeshCacheEntry());
+        out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(MeshCacheEntry));
+        entries.clear();
+        // The header is rewritten by finish(), once the node block's offset is part of it
+        header.nodeOffset = writeBlock(nodes.data(), nodes.size() * sizeof(ModelNode));
+        return static_cast<bool>(out);
+    }
+
+    void addMesh(const MeshAsset& asset, const char* vertexData, const char* indexData, const CpuMesh& mesh) {
+        MeshCacheEntry entry;
+        entry.vertexCount = static_cast<uint32_t>(asset.vertexCount);
+        entry.vertexStride = static_cast<uint32_t>(vertexStride(asset.vertexFormat));
+        entry.indexCount = static_cast<uint32_t>(asset.indexBytes / asset.indexSize());
+        entry.indexSize = static_cast<uint32_t>(asset.indexSize());
+        entry.bvhNodeCount = static_cast<uint32_t>(mesh.bvh.nodes.size());
+        entry.lodCount = static_cast<uint32_t>(asset.lods.size());
+        entry.acmrBefore = asset.acmrBefore;
+        entry.acmrAfter = asset.acmrAfter;
+        entry.bounds = asset.bounds;
+        entry.vertexOffset = writeBlock(vertexData, asset.vertexBytes);
+        entry.indexOffset = writeBlock(indexData, asset.indexBytes);
+        entry.bvhNodeOffset = writeBlock(mesh.bvh.nodes.data(), mesh.bvh.nodes.size() * sizeof(BVHNode));
+        entry.bvhTriangleOffset = writeBlock(mesh.bvh.triIndices.data(), mesh.bvh.triIndices.size() * sizeof(unsigned int));
+        entry.lodOffset = writeBlock(asset.lods.data(), asset.lods.size() * sizeof(MeshLod));
+        entries.push_back(entry);
+    }
+
+    bool finish() {
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(MeshCacheEntry));
+        bool written = static_cast<bool>(out);
+        out.close();
+
+        if (!written) {
+            std::remove(tempPath.c_str());
+            return false;
+        }
+        std::remove(finalPath.c_str());
+        return std::rename(tempPath.c_str(), finalPath.c_str()) == 0;
+    }
+
+    void abandon() {
+        if (out.is_open()) out.close();
+        std::remove(tempPath.c_str());
+    }
+
+private:
+    uint64_t writeBlock(const void* data, size_t bytes) {
+        return writeAlignedBlock(out, data, bytes);
+    }
+
+    std::ofstream out;
+    std::string tempPath, finalPath;
+    MeshCacheHeader header;
+    std::vector<MeshCacheEntry> entries;
+};
+
+const char MESH_STREAM_MAGIC[4] = { 'M', 'S', 'T', 'R' };
+const uint32_t MESH_STREAM_VERSION = 1;
+const char* const MESH_STREAM_EXTENSION = ".meshstream";
+// Chunks stay below 65536 vertices, so they always use 16-bit indices and fit one fixed-size pool slot
+const uint32_t STREAM_CHUNK_MAX_TRIANGLES = 16384;
+const uint32_t STREAM_CHUNK_MAX_VERTICES = STREAM_CHUNK_MAX_TRIANGLES * 3;
+
+// File layout: header, then 16-byte aligned chunk data, then the node hierarchy, mesh table and chunk table.
+// Importing only reads the tables; chunk data is touched when the streamer pages it in
+struct MeshStreamHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t meshCount, chunkCount, nodeCount;
+    uint64_t nodeOffset, meshOffset, chunkOffset;
+};
+
+struct MeshStreamMeshEntry {
+    uint32_t firstChunk, chunkCount;
+    MeshBounds bounds;
+};
+
+// Vertices are CompactVertex relative to the chunk's own bounds, indices are 16-bit
+struct MeshStreamChunk {
+    MeshBounds bounds;
+    uint32_t vertexCount, indexCount;
+    uint64_t vertexOffset, indexOffset;
+};
+
+// Chunk slot states besides a pool slot index
+const int32_t STREAM_CHUNK_NOT_RESIDENT = -1, STREAM_CHUNK_INVALID = -2;
+
+// A mesh whose geometry stays in the mapped stream file. Only the chunk table is held in memory; the chunk
+// streamer copies chunks into its GPU pool while they are visible
+struct StreamedMesh {
+    std::shared_ptr<MappedFile> file;
+    std::vector<MeshStreamChunk> chunks;
+    // Per chunk: the pool slot while resident, and the frame its pages were last prefetched
+    std::vector<int32_t> slots;
+    std::vector<uint64_t> prefetchFrames;
+};
+
+bool isMeshStreamPath(const std::string& path) {
+    size_t length = strlen(MESH_STREAM_EXTENSION);
+    return path.size() > length && path.compare(path.size() - length, length, MESH_STREAM_EXTENSION) == 0;
+}
+
+// Walks the node tree breadth-first. A node with several meshes gets one child node per mesh, and
+// meshes no node references become extra roots so nothing in the file is dropped
+void flattenNodeHierarchy(const aiScene* scene, std::vector<ModelNode>& nodes) {
+    nodes.clear();
+    std::vector<unsigned char> meshUsed(scene->mNumMeshes, 0);
+    std::deque<std::pair<const aiNode*, int32_t>> pending;
+    pending.push_back(std::make_pair(static_cast<const aiNode*>(scene->mRootNode), -1));
+
+    while (!pending.empty()) {
+        const aiNode* node = pending.front().first;
+        int32_t parent = pending.front().second;
+        pending.pop_front();
+
+        const aiMatrix4x4& m = node->mTransformation;
+        ModelNode flat;
+        flat.parent = parent;
+        flat.mesh = node->mNumMeshes == 1 ? static_cast<int32_t>(node->mMeshes[0]) : -1;
+        flat.transform = glm::mat4(m.a1, m.b1, m.c1, m.d1, m.a2, m.b2, m.c2, m.d2, m.a3, m.b3, m.c3, m.d3, m.a4, m.b4, m.c4, m.d4);
+        int32_t index = static_cast<int32_t>(nodes.size());
+        nodes.push_back(flat);
+
+        for (unsigned int i = 0; i < node->mNumMeshes; ++i) {
+            meshUsed[node->mMeshes[i]] = 1;
+            if (node->mNumMeshes == 1) continue;
+            ModelNode part;
+            part.parent = index;
+            part.mesh = static_cast<int32_t>(node->mMeshes[i]);
+            part.transform = glm::mat4(1.0f);
+            nodes.push_back(part);
+        }
+        for (unsigned int i = 0; i < node->mNumChildren; ++i) {
+            pending.push_back(std::make_pair(static_cast<const aiNode*>(node->mChildren[i]), index));
+        }
+    }
+
+    for (unsigned int mesh = 0; mesh < scene->mNumMeshes; ++mesh) {
+        if (meshUsed[mesh]) continue;
+        ModelNode orphan;
+        orphan.parent = -1;
+        orphan.mesh = static_cast<int32_t>(mesh);
+        orphan.transform = glm::mat4(1.0f);
+        nodes.push_back(orphan);
+    }
+}
+
+// Splits a triangle list into spatially coherent chunks of at most STREAM_CHUNK_MAX_TRIANGLES by repeatedly
+// cutting at the median triangle centroid along the longest axis
+void partitionTriangles(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices, std::vector<std::vector<uint32_t>>& chunks) {
+    uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+    std::vector<uint32_t> triangles(triangleCount);
+    std::vector<glm::vec3> centroids(triangleCount);
+    for (uint32_t t = 0; t < triangleCount; ++t) {
+        triangles[t] = t;
+        centroids[t] = (positions[indices[t * 3]] + positions[indices[t * 3 + 1]] + positions[indices[t * 3 + 2]]) / 3.0f;
+    }
+
+    // Ranges are split depth-first with the lower half on top, so neighbouring chunks end up next to each other in the file
+    std::vector<std::pair<uint32_t, uint32_t>> ranges(1, std::make_pair(0u, triangleCount));
+    while (!ranges.empty()) {
+        uint32_t first = ranges.back().first, last = ranges.back().second;
+        ranges.pop_back();
+        if (first == last) continue;
+        if (last - first <= STREAM_CHUNK_MAX_TRIANGLES) {
+            chunks.emplace_back(triangles.begin() + first, triangles.begin() + last);
+            continue;
+        }
+
+        glm::vec3 low(std::numeric_limits<float>::max()), high(-std::numeric_limits<float>::max());
+        for (uint32_t i = first; i < last; ++i) {
+            low = glm::min(low, centroids[triangles[i]]);
+            high = glm::max(high, centroids[triangles[i]]);
+        }
+        glm::vec3 extent = high - low;
+        int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+        uint32_t middle = first + (last - first) / 2;
+        std::nth_element(triangles.begin() + first, triangles.begin() + middle, triangles.begin() + last,
+            [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+        ranges.push_back(std::make_pair(middle, last));
+        ranges.push_back(std::make_pair(first, middle));
+    }
+}
+
+// Offline conversion behind --build-stream. This is the one step that holds the whole model in memory; the
+// chunks are written as they are built, so only the tables are kept until the end
+bool buildMeshStream(const std::string& sourcePath, const std::string& outputPath) {
+    Assimp::Importer importer;
+    const aiScene* scene = importer.ReadFile(sourcePath, IMPORT_FLAGS);
+    if (!scene || !scene->mRootNode || (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE)) {
+        std::cerr << "Error loading model: " << importer.GetErrorString() << std::endl;
+        return false;
+    }
+
+    std::string tempPath = outputPath + ".tmp";
+    std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "Failed to open " << tempPath << " for writing" << std::endl;
+        return false;
+    }
+
+    MeshStreamHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MESH_STREAM_MAGIC, sizeof(header.magic));
+    header.version = MESH_STREAM_VERSION;
+    header.meshCount = scene->mNumMeshes;
+    // Rewritten once the table offsets are known
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<ModelNode> nodes;
+    flattenNodeHierarchy(scene, nodes);
+    std::vector<MeshStreamMeshEntry> meshes(scene->mNumMeshes);
+    std::vector<MeshStreamChunk> chunks;
+
+    for (unsigned int meshIndex = 0; meshIndex < scene->mNumMeshes; ++meshIndex) {
+        std::vector<glm::vec3> positions, normals;
+        std::vector<unsigned int> indices;
+        extractMeshGeometry(scene->mMeshes[meshIndex], positions, normals, indices);
+
+        std::vector<std::vector<uint32_t>> triangleChunks;
+        partitionTriangles(positions, indices, triangleChunks);
+        MeshStreamMeshEntry& entry = meshes[meshIndex];
+        entry.firstChunk = static_cast<uint32_t>(chunks.size());
+        entry.chunkCount = static_cast<uint32_t>(triangleChunks.size());
+        entry.bounds = computeMeshBounds(positions);
+
+        // Maps mesh vertices to chunk vertices; reset after each chunk so vertices shared across a cut are duplicated
+        std::vector<uint32_t> remap(positions.size(), UINT32_MAX);
+        std::vector<glm::vec3> chunkPositions, chunkNormals;
+        std::vector<unsigned int> chunkIndices;
+        std::vector<CompactVertex> packedVertices;
+        std::vector<uint16_t> packedIndices;
+        for (const std::vector<uint32_t>& triangles : triangleChunks) {
+            chunkPositions.clear();
+            chunkNormals.clear();
+            chunkIndices.clear();
+            for (uint32_t t : triangles) {
+                for (int corner = 0; corner < 3; ++corner) {
+                    unsigned int vertex = indices[t * 3 + corner];
+                    if (remap[vertex] == UINT32_MAX) {
+                        remap[vertex] = static_cast<uint32_t>(chunkPositions.size());
+                        chunkPositions.push_back(positions[vertex]);
+                        chunkNormals.push_back(normals[vertex]);
+                    }
+                    chunkIndices.push_back(remap[vertex]);
+                }
+            }
+            for (uint32_t t : triangles) {
+                for (int corner = 0; corner < 3; ++corner) remap[indices[t * 3 + corner]] = UINT32_MAX;
+            }
+            optimizeMesh(chunkPositions, chunkNormals, chunkIndices);
+
+            MeshStreamChunk chunk;
+            chunk.bounds = computeMeshBounds(chunkPositions);
+            chunk.vertexCount = static_cast<uint32_t>(chunkPositions.size());
+            chunk.indexCount = static_cast<uint32_t>(chunkIndices.size());
+            packedVertices.resize(chunkPositions.size());
+            for (size_t i = 0; i < chunkPositions.size(); ++i) packedVertices[i] = packCompactVertex(chunkPositions[i], chunkNormals[i], chunk.bounds);
+            packedIndices.assign(chunkIndices.begin(), chunkIndices.end());
+            chunk.vertexOffset = writeAlignedBlock(out, packedVertices.data(), packedVertices.size() * sizeof(CompactVertex));
+            chunk.indexOffset = writeAlignedBlock(out, packedIndices.data(), packedIndices.size() * sizeof(uint16_t));
+            chunks.push_back(chunk);
+        }
+    }
+
+    header.chunkCount = static_cast<uint32_t>(chunks.size());
+    header.nodeCount = static_cast<uint32_t>(nodes.size());
+    header.nodeOffset = writeAlignedBlock(out, nodes.data(), nodes.size() * sizeof(ModelNode));
+    header.meshOffset = writeAlignedBlock(out, meshes.data(), meshes.size() * sizeof(MeshStreamMeshEntry));
+    header.chunkOffset = writeAlignedBlock(out, chunks.data(), chunks.size() * sizeof(MeshStreamChunk));
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    bool written = static_cast<bool>(out);
+    out.close();
+
+    if (!written) {
+        std::remove(tempPath.c_str());
+        std::cerr << "Failed to write " << outputPath << std::endl;
+        return false;
+    }
+    std::remove(outputPath.c_str());
+    if (std::rename(tempPath.c_str(), outputPath.c_str()) != 0) return false;
+    std::cout << "Wrote " << chunks.size() << " chunk(s) for " << meshes.size() << " mesh(es) to " << outputPath << std::endl;
+    return true;
+}
+
+const size_t IMPORT_UPLOAD_BUDGET_BYTES_PER_FRAME = 16 * 1024 * 1024;
+
+struct ImportJob {
+    enum State {
+        QUEUED,
+        PARSING,
+        UPLOADING,
+        DONE,
+        FAILED,
+        CANCELLED
+    };
+
+    std::string filePath;
+    std::atomic<int> state;
+    std::atomic<float> parseProgress;
+    std::atomic<bool> cancelRequested;
+    std::atomic<unsigned int> meshCount;
+    ImportSettings settings;
+    std::string error;
+
+    // Only touched by the render thread
+    unsigned int meshesUploaded;
+    std::vector<std::shared_ptr<MeshAsset>> stagedMeshes;
+
+    // Written by the worker before the job enters UPLOADING
+    std::vector<ModelNode> nodes;
+    uint64_t sourceBytes;
+    double parseSeconds;
+    std::chrono::steady_clock::time_point startTime;
+
+    ImportJob(const std::string& path, const ImportSettings& importSettings)
+        : filePath(path), state(QUEUED), parseProgress(0.0f), cancelRequested(false), meshCount(0), settings(importSettings), meshesUploaded(0),
+          sourceBytes(0), parseSeconds(0.0) {}
+};
+
+struct PendingMesh {
+    std::shared_ptr<ImportJob> job;
+    std::shared_ptr<CpuMesh> cpuMesh;
+    std::shared_ptr<MeshAsset> asset;
+
+    // Upload data points either into the storage vectors or into a mapped mesh cache kept alive by cacheFile
+    std::vector<unsigned char> vertexStorage, indexStorage;
+    std::shared_ptr<MappedFile> cacheFile;
+    const char* vertexData;
+    const char* indexData;
+
+    size_t vertexBytesUploaded, indexBytesUploaded;
+
+    PendingMesh() : asset(std::make_shared<MeshAsset>()), vertexData(nullptr), indexData(nullptr), vertexBytesUploaded(0), indexBytesUploaded(0) {}
+};
+
+class ImportProgressHandler : public Assimp::ProgressHandler {
+public:
+    explicit ImportProgressHandler(ImportJob& job) : job(job) {}
+
+    bool Update(float percentage) override {
+        if (percentage >= 0.0f) job.parseProgress = percentage * 0.8f;
+        return !job.cancelRequested;
+    }
+
+private:
+    ImportJob& job;
+};
+
+class ImportQueue {
+public:
+    ImportQueue() : stopping(false) {}
+    ~ImportQueue() { stop(); }
+
+    void start(unsigned int workerCount) {
+        for (unsigned int i = 0; i < workerCount; ++i) {
+            workers.emplace_back(&ImportQueue::workerLoop, this);
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            stopping = true;
+            for (auto& job : jobs) job->cancelRequested = true;
+        }
+        jobAvailable.notify_all();
+        for (auto& worker : workers) worker.join();
+        workers.clear();
+    }
+
+    std::shared_ptr<ImportJob> enqueue(const std::string& filePath, const ImportSettings& settings) {
+        auto job = std::make_shared<ImportJob>(filePath, settings);
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            jobs.push_back(job);
+        }
+        jobAvailable.notify_one();
+        return job;
+    }
+
+    std::unique_ptr<PendingMesh> popFinishedMesh() {
+        std::lock_guard<std::mutex> lock(finishedMutex);
+        if (finishedMeshes.empty()) return nullptr;
+        std::unique_ptr<PendingMesh> mesh = std::move(finishedMeshes.front());
+        finishedMeshes.pop_front();
+        return mesh;
+    }
+
+private:
+    void workerLoop() {
+        while (true) {
+            std::shared_ptr<ImportJob> job;
+            {
+                std::unique_lock<std::mutex> lock(jobMutex);
+                jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping) return;
+                job = jobs.front();
+                jobs.pop_front();
+            }
+            runJob(job);
+        }
+    }
+
+    void runJob(const std::shared_ptr<ImportJob>& job) {
+        if (job->cancelRequested) {
+            job->state = ImportJob::CANCELLED;
+            return;
+        }
+        job->state = ImportJob::PARSING;
+        job->startTime = std::chrono::steady_clock::now();
+        getFileSize(job->filePath, job->sourceBytes);
+
+        if (isMeshStreamPath(job->filePath)) {
+            if (!postStreamedMeshes(job)) {
+                job->error = "Not a valid mesh stream file: " + job->filePath;
+                job->state = ImportJob::FAILED;
+            }
+            return;
+        }
+
+        int64_t sourceModifiedTime = 0;
+        bool hasModifiedTime = getFileModifiedTime(job->filePath, sourceModifiedTime);
+        if (hasModifiedTime && job->settings.useMeshCache) {
+            std::shared_ptr<MappedFile> cacheFile = openMeshCache(job->filePath, sourceModifiedTime, job->settings);
+            if (cacheFile && postCachedMeshes(job, cacheFile)) return;
+        }
+
+        Assimp::Importer importer;
+        importer.SetProgressHandler(new ImportProgressHandler(*job));
+        const aiScene* scene = importer.ReadFile(job->filePath, IMPORT_FLAGS);
+
+        if (job->cancelRequested) {
+            job->state = ImportJob::CANCELLED;
+            return;
+        }
+        if (!scene || !scene->mRootNode || (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE)) {
+            job->error = importer.GetErrorString();
+            job->state = ImportJob::FAILED;
+            return;
+        }
+
+        job->parseSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - job->startTime).count();
+        flattenNodeHierarchy(scene, job->nodes);
+        MeshCacheWriter cacheWriter;
+        bool writingCache = job->settings.useMeshCache && hasModifiedTime && cacheWriter.open(job->filePath, sourceModifiedTime, job->settings, scene->mNumMeshes, job->nodes);
+
+        // Largest meshes first, so a big mesh does not start last and leave the other workers idle
+        std::vector<unsigned int> order(scene->mNumMeshes);
+        for (unsigned int i = 0; i < scene->mNumMeshes; ++i) order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+            return scene->mMeshes[a]->mNumFaces > scene->mMeshes[b]->mNumFaces;
+        });
+
+        // Meshes finish in any order but are cached and handed to the uploader in file order, so the cache
+        // layout and the upload order match a serial import
+        std::vector<std::unique_ptr<PendingMesh>> converted(scene->mNumMeshes);
+        std::mutex postMutex;
+        size_t nextToPost = 0;
+        importWorkers.parallelFor(order.size(), [&](size_t i) {
+            if (job->cancelRequested) return;
+            unsigned int meshIndex = order[i];
+            std::unique_ptr<PendingMesh> pending = convertMesh(job, scene->mMeshes[meshIndex]);
+
+            std::lock_guard<std::mutex> lock(postMutex);
+            converted[meshIndex] = std::move(pending);
+            for (; nextToPost < converted.size() && converted[nextToPost]; ++nextToPost) {
+                PendingMesh& ready = *converted[nextToPost];
+                if (writingCache) cacheWriter.addMesh(*ready.asset, ready.vertexData, ready.indexData, *ready.cpuMesh);
+                {
+                    std::lock_guard<std::mutex> finishedLock(finishedMutex);
+                    finishedMeshes.push_back(std::move(converted[nextToPost]));
+                }
+                job->parseProgress = 0.8f + 0.2f * (nextToPost + 1) / scene->mNumMeshes;
+            }
+        });
+
+        if (job->cancelRequested) {
+            if (writingCache) cacheWriter.abandon();
+            job->state = ImportJob::CANCELLED;
+            return;
+        }
+
+        if (writingCache && !cacheWriter.finish()) {
+            std::cerr << "Failed to write mesh cache for " << job->filePath << std::endl;
+        }
+
+        job->meshCount = scene->mNumMeshes;
+        job->parseProgress = 1.0f;
+        job->state = ImportJob::UPLOADING;
+    }
+
+    // Turns one Assimp mesh into upload-ready data plus the CPU copy used for picking. Called from several
+    // import workers at once, so it only touches the mesh and the job settings
+    std::unique_ptr<PendingMesh> convertMesh(const std::shared_ptr<ImportJob>& job, const aiMesh* mesh) {
+        std::unique_ptr<PendingMesh> pending(new PendingMesh());
+        pending->job = job;
+        MeshAsset& asset = *pending->asset;
+
+        auto cpuMesh = std::make_shared<CpuMesh>();
+        std::vector<glm::vec3> positions, normals;
+        std::vector<unsigned int>& indices = cpuMesh->indices;
+        extractMeshGeometry(mesh, positions, normals, indices);
+
+        asset.acmrBefore = computeACMR(indices, positions.size());
+        if (job->settings.optimizeMeshes) optimizeMesh(positions, normals, indices);
+        asset.acmrAfter = computeACMR(indices, positions.size());
+
+        asset.bounds = computeMeshBounds(positions);
+        asset.vertexCount = static_cast<int>(positions.size());
+        asset.indexCount = static_cast<int>(indices.size());
+        if (job->settings.generateLods) buildMeshLods(positions, indices, asset.lods);
+        else asset.lods.assign(1, MeshLod(0, asset.indexCount, 0.0f));
+
+        packVertices(positions, normals, *pending, job->settings.vertexFormat());
+        packIndices(indices, positions.size(), *pending);
+
+        // Only the full-detail level is kept on the CPU for picking
+        indices.resize(asset.indexCount);
+        indices.shrink_to_fit();
+
+        // Pick against what is actually drawn, so the BVH is built over the decoded positions
+        if (asset.vertexFormat == VertexFormat::COMPACT) {
+            const CompactVertex* vertices = reinterpret_cast<const CompactVertex*>(pending->vertexData);
+            importWorkers.parallelForRange(positions.size(), IMPORT_TASK_GRAIN, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) positions[i] = unpackCompactPosition(vertices[i], asset.bounds);
+            });
+        }
+        cpuMesh->positions.swap(positions);
+        buildMeshBVH(*cpuMesh);
+        pending->cpuMesh = cpuMesh;
+        return pending;
+    }
+
+    void packVertices(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals, PendingMesh& pending, VertexFormat format) {
+        MeshAsset& asset = *pending.asset;
+        asset.vertexFormat = format;
+        asset.vertexBytes = positions.size() * vertexStride(format);
+        pending.vertexStorage.resize(asset.vertexBytes);
+        pending.vertexData = reinterpret_cast<const char*>(pending.vertexStorage.data());
+
+        if (format == VertexFormat::COMPACT) {
+            asset.positionDecode = positionDecodeMatrix(asset.bounds);
+            CompactVertex* vertices = reinterpret_cast<CompactVertex*>(pending.vertexStorage.data());
+            importWorkers.parallelForRange(positions.size(), IMPORT_TASK_GRAIN, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) vertices[i] = packCompactVertex(positions[i], normals[i], asset.bounds);
+            });
+            return;
+        }
+
+        float* vertices = reinterpret_cast<float*>(pending.vertexStorage.data());
+        importWorkers.parallelForRange(positions.size(), IMPORT_TASK_GRAIN, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                vertices[i * 6 + 0] = positions[i].x;
+                vertices[i * 6 + 1] = positions[i].y;
+                vertices[i * 6 + 2] = positions[i].z;
+                vertices[i * 6 + 3] = normals[i].x;
+                vertices[i * 6 + 4] = normals[i].y;
+                vertices[i * 6 + 5] = normals[i].z;
+            }
+        });
+    }
+
+    void packIndices(const std::vector<unsigned int>& indices, size_t vertexCount, PendingMesh& pending) {
+        MeshAsset& asset = *pending.asset;
+        bool shortIndices = asset.vertexFormat == VertexFormat::COMPACT && vertexCount <= 65536;
+        asset.indexType = shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        asset.indexBytes = indices.size() * asset.indexSize();
+        pending.indexStorage.resize(asset.indexBytes);
+        pending.indexData = reinterpret_cast<const char*>(pending.indexStorage.data());
+
+        if (shortIndices) {
+            uint16_t* packed = reinterpret_cast<uint16_t*>(pending.indexStorage.data());
+            importWorkers.parallelForRange(indices.size(), IMPORT_TASK_GRAIN, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) packed[i] = static_cast<uint16_t>(indices[i]);
+            });
+        }
+        else {
+            memcpy(pending.indexStorage.data(), indices.data(), asset.indexBytes);
+        }
+    }
+
+    // Checks what the picking BVH and the GPU index fetch index into, so a stale or damaged cache falls back to
+    // Assimp instead of reading out of bounds. Offsets and sizes are already known to lie inside the file
+    static bool cachedMeshContentsValid(const char* base, const MeshCacheEntry& entry, uint32_t triangleCount) {
+        if (entry.indexSize == 2) {
+            const uint16_t* indices = reinterpret_cast<const uint16_t*>(base + entry.indexOffset);
+            for (uint32_t i = 0; i < entry.indexCount; ++i) {
+                if (indices[i] >= entry.vertexCount) return false;
+            }
+        }
+        else {
+            const unsigned int* indices = reinterpret_cast<const unsigned int*>(base + entry.indexOffset);
+            for (uint32_t i = 0; i < entry.indexCount; ++i) {
+                if (indices[i] >= entry.vertexCount) return false;
+            }
+        }
+
+        // Children are always stored after their parent, which also rules out cycles
+        for (uint32_t i = 0; i < entry.bvhNodeCount; ++i) {
+            BVHNode node;
+            memcpy(&node, base + entry.bvhNodeOffset + size_t(i) * sizeof(BVHNode), sizeof(node));
+            bool valid = node.isLeaf() ?
+                uint64_t(node.leftFirst) + node.triCount <= triangleCount :
+                node.leftFirst > i && uint64_t(node.leftFirst) + 1 < entry.bvhNodeCount;
+            if (!valid) return false;
+        }
+
+        const unsigned int* triIndices = reinterpret_cast<const unsigned int*>(base + entry.bvhTriangleOffset);
+        for (uint32_t i = 0; i < triangleCount; ++i) {
+            if (triIndices[i] >= triangleCount) return false;
+        }
+        return true;
+    }
+
+    // Hands the mapped vertex and index blocks straight to the uploader; only the picking copies are rebuilt from the file
+    bool postCachedMeshes(const std::shared_ptr<ImportJob>& job, const std::shared_ptr<MappedFile>& cacheFile) {
+        const char* base = cacheFile->data();
+        MeshCacheHeader header;
+        memcpy(&header, base, sizeof(header));
+        VertexFormat format = static_cast<VertexFormat>(header.vertexFormat);
+
+        std::vector<MeshCacheEntry> entries(header.meshCount);
+        memcpy(entries.data(), base + sizeof(header), entries.size() * sizeof(MeshCacheEntry));
+
+        if (header.nodeOffset + uint64_t(header.nodeCount) * sizeof(ModelNode) > cacheFile->size()) return false;
+        std::vector<ModelNode> nodes(header.nodeCount);
+        memcpy(nodes.data(), base + header.nodeOffset, nodes.size() * sizeof(ModelNode));
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (nodes[i].parent >= static_cast<int32_t>(i) || nodes[i].mesh >= static_cast<int32_t>(header.meshCount)) return false;
+        }
+
+        std::vector<std::vector<MeshLod>> meshLods(header.meshCount);
+        for (unsigned int meshIndex = 0; meshIndex < header.meshCount; ++meshIndex) {
+            const MeshCacheEntry& entry = entries[meshIndex];
+            bool inBounds = entry.vertexStride == vertexStride(format) &&
+                (entry.indexSize == 2 || entry.indexSize == 4) &&
+                entry.lodCount > 0 &&
+                entry.vertexOffset + uint64_t(entry.vertexCount) * entry.vertexStride <= cacheFile->size() &&
+                entry.indexOffset + uint64_t(entry.indexCount) * entry.indexSize <= cacheFile->size() &&
+                entry.bvhNodeOffset + uint64_t(entry.bvhNodeCount) * sizeof(BVHNode) <= cacheFile->size() &&
+                entry.lodOffset + uint64_t(entry.lodCount) * sizeof(MeshLod) <= cacheFile->size();
+            if (!inBounds) return false;
+
+            std::vector<MeshLod>& lods = meshLods[meshIndex];
+            lods.resize(entry.lodCount);
+            memcpy(lods.data(), base + entry.lodOffset, lods.size() * sizeof(MeshLod));
+            for (const MeshLod& lod : lods) {
+                if (uint64_t(lod.firstIndex) + lod.indexCount > entry.indexCount) return false;
+            }
+            if (entry.bvhTriangleOffset + uint64_t(lods[0].indexCount / 3) * sizeof(unsigned int) > cacheFile->size()) return false;
+            if (!cachedMeshContentsValid(base, entry, lods[0].indexCount / 3)) return false;
+        }
+
+        for (unsigned int meshIndex = 0; meshIndex < header.meshCount; ++meshIndex) {
+            if (job->cancelRequested) {
+                job->state = ImportJob::CANCELLED;
+                return true;
+            }
+
+            const MeshCacheEntry& entry = entries[meshIndex];
+            std::unique_ptr<PendingMesh> pending(new PendingMesh());
+            pending->job = job;
+            pending->cacheFile = cacheFile;
+            pending->vertexData = base + entry.vertexOffset;
+            pending->indexData = base + entry.indexOffset;
+
+            MeshAsset& asset = *pending->asset;
+            asset.lods.swap(meshLods[meshIndex]);
+            asset.vertexCount = static_cast<int>(entry.vertexCount);
+            asset.indexCount = static_cast<int>(asset.lods[0].indexCount);
+            asset.vertexFormat = format;
+            asset.indexType = entry.indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+            asset.vertexBytes = size_t(entry.vertexCount) * entry.vertexStride;
+            asset.indexBytes = size_t(entry.indexCount) * entry.indexSize;
+            asset.bounds = entry.bounds;
+            asset.acmrBefore = entry.acmrBefore;
+            asset.acmrAfter = entry.acmrAfter;
+            if (format == VertexFormat::COMPACT) asset.positionDecode = positionDecodeMatrix(entry.bounds);
+
+            auto cpuMesh = std::make_shared<CpuMesh>();
+            cpuMesh->positions.resize(entry.vertexCount);
+            for (uint32_t i = 0; i < entry.vertexCount; ++i) {
+                const char* vertex = pending->vertexData + size_t(i) * entry.vertexStride;
+                if (format == VertexFormat::COMPACT) {
+                    CompactVertex compact;
+                    memcpy(&compact, vertex, sizeof(compact));
+                    cpuMesh->positions[i] = unpackCompactPosition(compact, entry.bounds);
+                }
+                else {
+                    memcpy(&cpuMesh->positions[i], vertex, sizeof(glm::vec3));
+                }
+            }
+            cpuMesh->indices.resize(asset.indexCount);
+            if (entry.indexSize == 2) {
+                const uint16_t* indices = reinterpret_cast<const uint16_t*>(pending->indexData);
+                for (int i = 0; i < asset.indexCount; ++i) cpuMesh->indices[i] = indices[i];
+            }
+            else {
+                memcpy(cpuMesh->indices.data(), pending->indexData, asset.indexCount * sizeof(unsigned int));
+            }
+            cpuMesh->bvh.nodes.resize(entry.bvhNodeCount);
+            memcpy(cpuMesh->bvh.nodes.data(), base + entry.bvhNodeOffset, entry.bvhNodeCount * sizeof(BVHNode));
+            cpuMesh->bvh.triIndices.resize(asset.indexCount / 3);
+            memcpy(cpuMesh->bvh.triIndices.data(), base + entry.bvhTriangleOffset, cpuMesh->bvh.triIndices.size() * sizeof(unsigned int));
+            pending->cpuMesh = cpuMesh;
+
+            {
+                std::lock_guard<std::mutex> lock(finishedMutex);
+                finishedMeshes.push_back(std::move(pending));
+            }
+            job->parseProgress = float(meshIndex + 1) / header.meshCount;
+        }
+
+        job->nodes.swap(nodes);
+        job->meshCount = header.meshCount;
+        job->parseProgress = 1.0f;
+        job->state = ImportJob::UPLOADING;
+        return true;
+    }
+
+    // Reads and checks only the tables of a stream file; the meshes go to the uploader without any geometry
+    bool postStreamedMeshes(const std::shared_ptr<ImportJob>& job) {
+        auto file = std::make_shared<MappedFile>();
+        if (!file->open(job->filePath) || file->size() < sizeof(MeshStreamHeader)) return false;
+
+        const char* base = file->data();
+        MeshStreamHeader header;
+        memcpy(&header, base, sizeof(header));
+        bool valid = memcmp(header.magic, MESH_STREAM_MAGIC, sizeof(header.magic)) == 0 &&
+            header.version == MESH_STREAM_VERSION &&
+            header.nodeOffset + uint64_t(header.nodeCount) * sizeof(ModelNode) <= file->size() &&
+            header.meshOffset + uint64_t(header.meshCount) * sizeof(MeshStreamMeshEntry) <= file->size() &&
+            header.chunkOffset + uint64_t(header.chunkCount) * sizeof(MeshStreamChunk) <= file->size();
+        if (!valid) return false;
+
+        std::vector<ModelNode> nodes(header.nodeCount);
+        memcpy(nodes.data(), base + header.nodeOffset, nodes.size() * sizeof(ModelNode));
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (nodes[i].parent >= static_cast<int32_t>(i) || nodes[i].mesh >= static_cast<int32_t>(header.meshCount)) return false;
+        }
+
+        std::vector<MeshStreamMeshEntry> meshes(header.meshCount);
+        memcpy(meshes.data(), base + header.meshOffset, meshes.size() * sizeof(MeshStreamMeshEntry));
+        std::vector<MeshStreamChunk> chunks(header.chunkCount);
+        memcpy(chunks.data(), base + header.chunkOffset, chunks.size() * sizeof(MeshStreamChunk));
+        for (const MeshStreamChunk& chunk : chunks) {
+            bool inBounds = chunk.vertexCount > 0 && chunk.vertexCount <= STREAM_CHUNK_MAX_VERTICES &&
+                chunk.indexCount % 3 == 0 && chunk.indexCount <= STREAM_CHUNK_MAX_TRIANGLES * 3 &&
+                chunk.vertexOffset + uint64_t(chunk.vertexCount) * sizeof(CompactVertex) <= file->size() &&
+                chunk.indexOffset + uint64_t(chunk.indexCount) * sizeof(uint16_t) <= file->size();
+            if (!inBounds) return false;
+        }
+        for (const MeshStreamMeshEntry& entry : meshes) {
+            if (uint64_t(entry.firstChunk) + entry.chunkCount > header.chunkCount) return false;
+        }
+
+        for (unsigned int meshIndex = 0; meshIndex < header.meshCount; ++meshIndex) {
+            if (job->cancelRequested) {
+                job->state = ImportJob::CANCELLED;
+                return true;
+            }
+
+            const MeshStreamMeshEntry& entry = meshes[meshIndex];
+            auto streamed = std::make_shared<StreamedMesh>();
+            streamed->file = file;
+            streamed->chunks.assign(chunks.begin() + entry.firstChunk, chunks.begin() + entry.firstChunk + entry.chunkCount);
+            streamed->slots.assign(entry.chunkCount, STREAM_CHUNK_NOT_RESIDENT);
+            streamed->prefetchFrames.assign(entry.chunkCount, 0);
+
+            std::unique_ptr<PendingMesh> pending(new PendingMesh());
+            pending->job = job;
+            MeshAsset& asset = *pending->asset;
+            asset.vertexFormat = VertexFormat::COMPACT;
+            asset.indexType = GL_UNSIGNED_SHORT;
+            asset.bounds = entry.bounds;
+            asset.streamed = streamed;
+
+            {
+                std::lock_guard<std::mutex> lock(finishedMutex);
+                finishedMeshes.push_back(std::move(pending));
+            }
+        }
+
+        job->nodes.swap(nodes);
+        job->meshCount = header.meshCount;
+        job->parseProgress = 1.0f;
+        job->state = ImportJob::UPLOADING;
+        return true;
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex jobMutex;
+    std::condition_variable jobAvailable;
+    std::deque<std::shared_ptr<ImportJob>> jobs;
+    bool stopping;
+
+    std::mutex finishedMutex;
+    std::deque<std::unique_ptr<PendingMesh>> finishedMeshes;
+};
+
+ImportQueue importQueue;
+ImportSettings importSettings;
+std::vector<std::shared_ptr<ImportJob>> importJobs;
+std::unique_ptr<PendingMesh> currentUpload;
+
+// Meshes of a model that was imported again while its earlier copy was still in the scene
+std::vector<std::shared_ptr<MeshAsset>> retiredMeshes;
+
+// Drops imported models that no scene object uses any more and returns their meshes' ranges to the pool.
+// Importing the same file again then goes through the mesh cache instead of instancing the old meshes
+void releaseUnusedModels() {
+    for (auto it = retiredMeshes.begin(); it != retiredMeshes.end();) {
+        if (it->use_count() > 1) {
+            ++it;
+            continue;
+        }
+        meshBufferPool.release(**it);
+        it = retiredMeshes.erase(it);
+    }
+    for (auto it = loadedModels.begin(); it != loadedModels.end();) {
+        bool used = false;
+        for (const auto& mesh : it->second.meshes) used = used || mesh.use_count() > 1;
+        if (used) {
+            ++it;
+            continue;
+        }
+        for (const auto& mesh : it->second.meshes) meshBufferPool.release(*mesh);
+        it = loadedModels.erase(it);
+    }
+}
+
+// Creates one entity per hierarchy node, so moving the model's root moves the whole model
+void instantiateModel(const LoadedModel& model) {
+    std::vector<EntityHandle> created(model.nodes.size());
+    for (size_t i = 0; i < model.nodes.size(); ++i) {
+        const ModelNode& node = model.nodes[i];
+        std::shared_ptr<MeshAsset> mesh = node.mesh >= 0 && node.mesh < static_cast<int32_t>(model.meshes.size()) ? model.meshes[node.mesh] : nullptr;
+        EntityHandle parent = node.parent >= 0 ? created[node.parent] : EntityHandle();
+        created[i] = sceneObjects.create(mesh, parent, node.transform);
+    }
+}
+
+// Uploads finished meshes in slices so a large import never costs more than the budget in one frame
+void processImportUploads(size_t budgetBytes) {
+    while (budgetBytes > 0) {
+        if (!currentUpload) {
+            currentUpload = importQueue.popFinishedMesh();
+            if (!currentUpload) break;
+        }
+
+        PendingMesh& pending = *currentUpload;
+        if (pending.job->cancelRequested) {
+            meshBufferPool.release(*pending.asset);
+            currentUpload.reset();
+            continue;
+        }
+
+        const size_t vertexBytes = pending.asset->vertexBytes;
+        const size_t indexBytes = pending.asset->indexBytes;
+
+        if (!pending.asset->VAO && !pending.asset->streamed) meshBufferPool.allocate(*pending.asset);
+
+        // The offsets are read on every slice, since compaction may move a mesh that is still uploading
+        if (pending.vertexBytesUploaded < vertexBytes) {
+            size_t chunk = std::min(budgetBytes, vertexBytes - pending.vertexBytesUploaded);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, meshBufferPool.vertexBuffer(pending.asset->vertexFormat));
+            glBufferSubData(GL_COPY_WRITE_BUFFER, pending.asset->vertexOffset + pending.vertexBytesUploaded, chunk, pending.vertexData + pending.vertexBytesUploaded);
+            frameStats.bytesUploaded += chunk;
+            pending.vertexBytesUploaded += chunk;
+            budgetBytes -= chunk;
+        }
+        if (budgetBytes > 0 && pending.indexBytesUploaded < indexBytes) {
+            size_t chunk = std::min(budgetBytes, indexBytes - pending.indexBytesUploaded);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, meshBufferPool.indexBuffer(pending.asset->vertexFormat));
+            glBufferSubData(GL_COPY_WRITE_BUFFER, pending.asset->indexOffset + pending.indexBytesUploaded, chunk, pending.indexData + pending.indexBytesUploaded);
+            frameStats.bytesUploaded += chunk;
+            pending.indexBytesUploaded += chunk;
+            budgetBytes -= chunk;
+        }
+
+        if (pending.vertexBytesUploaded == vertexBytes && pending.indexBytesUploaded == indexBytes) {
+            pending.asset->cpuMesh = pending.cpuMesh;
+            pending.job->stagedMeshes.push_back(pending.asset);
+            pending.job->meshesUploaded++;
+            currentUpload.reset();
+        }
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    for (auto it = importJobs.begin(); it != importJobs.end();) {
+        ImportJob& job = **it;
+        int state = job.state;
+
+        if (state == ImportJob::FAILED) {
+            std::cerr << "Error loading model: " << job.error << std::endl;
+        }
+        else if (job.cancelRequested && state != ImportJob::PARSING) {
+            for (auto& mesh : job.stagedMeshes) meshBufferPool.release(*mesh);
+            job.state = ImportJob::CANCELLED;
+            std::cout << "Cancelled import of " << job.filePath << std::endl;
+        }
+        else if (state == ImportJob::UPLOADING && job.meshesUploaded == job.meshCount) {
+            LoadedModel& model = loadedModels[job.filePath];
+            // Swapped rather than copied, so the model holds the only reference and releaseUnusedModels() can see
+            // when its last instance is deleted
+            retiredMeshes.insert(retiredMeshes.end(), model.meshes.begin(), model.meshes.end());
+            model.meshes.clear();
+            model.meshes.swap(job.stagedMeshes);
+            model.nodes.swap(job.nodes);
+            instantiateModel(model);
+            job.state = ImportJob::DONE;
+
+            size_t gpuBytes = 0, uncompressedBytes = 0;
+            double missesBefore = 0.0, missesAfter = 0.0, triangles = 0.0;
+            for (const auto& mesh : model.meshes) {
+                gpuBytes += mesh->gpuBytes();
+                uncompressedBytes += mesh->uncompressedBytes();
+                missesBefore += mesh->acmrBefore * (mesh->indexCount / 3);
+                missesAfter += mesh->acmrAfter * (mesh->indexCount / 3);
+                triangles += mesh->indexCount / 3;
+            }
+            std::cout << "Imported " << job.meshCount << " mesh(es) from " << job.filePath << " ("
+                << gpuBytes / 1024 << " KB on GPU, " << (uncompressedBytes - gpuBytes) / 1024 << " KB saved";
+            if (triangles > 0.0) std::cout << ", ACMR " << missesBefore / triangles << " -> " << missesAfter / triangles;
+            std::cout << ")" << std::endl;
+
+            // Measured from when a worker picked the job up to the last upload, so it includes any frames spent uploading
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - job.startTime).count();
+            double megabytes = job.sourceBytes / (1024.0 * 1024.0);
+            std::cout << "  " << megabytes << " MB in " << seconds << " s (" << job.parseSeconds << " s in Assimp), "
+                << (seconds > 0.0 ? megabytes / seconds : 0.0) << " MB/s with " << importWorkers.threadCount() << " import thread(s)" << std::endl;
+        }
+        else {
+            ++it;
+            continue;
+        }
+        it = importJobs.erase(it);
+    }
+}
+
+void openImportDialog() {
+    const char* filters[] = { "*.obj", "*.fbx", "*.gltf", "*.dae", "*.meshstream" };
+    const char* filePath = tinyfd_openFileDialog(
+        "Select Model File",
+        "",
+        5, filters,
+        "Supported Model Files",
+        0
+    );
+
+    if (filePath) {
+        auto loaded = loadedModels.find(filePath);
+        if (loaded != loadedModels.end()) {
+            instantiateModel(loaded->second);
+            std::cout << "Instanced " << loaded->second.meshes.size() << " mesh(es) from " << filePath << std::endl;
+        }
+        else {
+            importJobs.push_back(importQueue.enqueue(filePath, importSettings));
+        }
+    }
+}
+
+struct SceneFramebuffer {
+    GLuint fbo, colorTexture, maskTexture, idTexture, depthStencilBuffer;
+    int width, height;
+    SceneFramebuffer() : fbo(0), colorTexture(0), maskTexture(0), idTexture(0), depthStencilBuffer(0), width(0), height(0) {}
+};
+
+SceneFramebuffer sceneFramebuffer;
+GLuint fullscreenVAO;
+
+GLuint createRenderTexture(GLint internalFormat, GLenum format, GLenum type, int width, int height) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+bool setupSceneFramebuffer(int width, int height) {
+    SceneFramebuffer& target = sceneFramebuffer;
+    target.width = width;
+    target.height = height;
+    target.colorTexture = createRenderTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+    target.maskTexture = createRenderTexture(GL_R8, GL_RED, GL_UNSIGNED_BYTE, width, height);
+    target.idTexture = createRenderTexture(GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, width, height);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenRenderbuffers(1, &target.depthStencilBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, target.depthStencilBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &target.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.colorTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, target.maskTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, target.idTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, target.depthStencilBuffer);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (!complete) std::cerr << "Scene framebuffer is incomplete!" << std::endl;
+
+    glGenVertexArrays(1, &fullscreenVAO);
+    return complete;
+}
+
+void setIdBufferWrites(bool enabled) {
+    if (enabled) {
+        const GLenum buffers[] = { GL_COLOR_ATTACHMENT0, GL_NONE, GL_COLOR_ATTACHMENT2 };
+        glDrawBuffers(3, buffers);
+    }
+    else {
+        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    }
+}
+
+void beginScenePass() {
+    const SceneFramebuffer& target = sceneFramebuffer;
+    glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+    glViewport(0, 0, target.width, target.height);
+
+    const GLfloat clearColor[] = { 0.25f, 0.25f, 0.25f, 1.0f };
+    const GLfloat clearMask[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    const GLuint clearId[] = { PICK_ID_NONE, 0, 0, 0 };
+    glStencilMask(0xFF);
+    glClearBufferfv(GL_COLOR, 0, clearColor);
+    glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+    glDrawBuffer(GL_COLOR_ATTACHMENT1);
+    glClearBufferfv(GL_COLOR, 0, clearMask);
+
+    // Light cubes and objects write their pick IDs next to the color; setIdBufferWrites(false) ends that
+    if (idBufferPicking) {
+        glDrawBuffer(GL_COLOR_ATTACHMENT2);
+        glClearBufferuiv(GL_COLOR, 0, clearId);
+    }
+    setIdBufferWrites(idBufferPicking);
+
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_STENCIL_TEST);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+    glStencilFunc(GL_ALWAYS, 0, 0xFF);
+    glStencilMask(0x00);
+}
+
+// Turns the stencil written by the highlighted objects into a mask and outlines them while copying the scene to the window
+void resolveScenePass(const ShaderProgram& selectionMaskShader, const ShaderProgram& compositeShader, GLuint outputFramebuffer, int outputX, int outputY) {
+    glBindVertexArray(fullscreenVAO);
+    glDisable(GL_DEPTH_TEST);
+    frameStats.stateChanges += 3;
+
+    glDrawBuffer(GL_COLOR_ATTACHMENT1);
+    glStencilFunc(GL_EQUAL, 1, 0xFF);
+    glUseProgram(selectionMaskShader.id);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glDisable(GL_STENCIL_TEST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+    glViewport(outputX, outputY, sceneFramebuffer.width, sceneFramebuffer.height);
+
+    glUseProgram(compositeShader.id);
+    glUniform1i(compositeShader.location(Uniform::SCENE_COLOR), 0);
+    glUniform1i(compositeShader.location(Uniform::SELECTION_MASK), 1);
+    glUniform3f(compositeShader.location(Uniform::OUTLINE_COLOR), 1.0f, 1.0f, 0.0f);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, sceneFramebuffer.maskTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, sceneFramebuffer.colorTexture);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    frameStats.drawCalls += 2;
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindVertexArray(0);
+    glEnable(GL_DEPTH_TEST);
+}
+
+// Reads the pick IDs under the cursor or a marquee out of the scene's ID attachment. The copy goes into a pixel
+// buffer object and is mapped once its fence has signalled, normally on the next frame, so picking never waits
+// on the GPU and costs the same however many triangles are on screen.
+class IdBufferPicker {
+public:
+    IdBufferPicker() : pbo(0), fence(0), inFlight(false), pixelCount(0), objectLayoutVersion(0), lightLayoutVersion(0) {}
+
+    void setup() {
+        glGenBuffers(1, &pbo);
+    }
+
+    // Called with the scene framebuffer bound, once everything that writes IDs has been drawn
+    void capture() {
+        if (!pickRequest.pending || inFlight) return;
+        request = pickRequest;
+        pickRequest.pending = false;
+
+        const SceneFramebuffer& target = sceneFramebuffer;
+        if (request.x1 < 0 || request.y1 < 0 || request.x0 >= target.width || request.y0 >= target.height) {
+            // A click outside the viewport behaves like a click on the background
+            pickedIds.clear();
+            applySelection();
+            return;
+        }
+        int x0 = std::max(request.x0, 0), y0 = std::max(request.y0, 0);
+        int width = std::min(request.x1, target.width - 1) - x0 + 1;
+        int height = std::min(request.y1, target.height - 1) - y0 + 1;
+        pixelCount = size_t(width) * height;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, pixelCount * sizeof(GLuint), nullptr, GL_STREAM_READ);
+        glReadBuffer(GL_COLOR_ATTACHMENT2);
+        glReadPixels(x0, y0, width, height, GL_RED_INTEGER, GL_UNSIGNED_INT, (void*)0);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        objectLayoutVersion = sceneObjects.layoutVersion();
+        lightLayoutVersion = sceneLights.layoutVersion();
+        inFlight = true;
+    }
+
+    // Applies a finished readback to the selection; returns straight away while the GPU is still busy
+    void poll() {
+        if (!inFlight) return;
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED) return;
+        glDeleteSync(fence);
+        fence = 0;
+        inFlight = false;
+        if (status == GL_WAIT_FAILED) return;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        const GLuint* ids = static_cast<const GLuint*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixelCount * sizeof(GLuint), GL_MAP_READ_BIT));
+        if (ids) {
+            pickedIds.assign(ids, ids + pixelCount);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (!ids) return;
+
+        // A removal since the capture moved entities to other dense indices, so the IDs would name the wrong ones
+        if (sceneObjects.layoutVersion() != objectLayoutVersion || sceneLights.layoutVersion() != lightLayoutVersion) return;
+        applySelection();
+    }
+
+private:
+    // Objects sort before lights, so a marquee over both makes an object the primary selection; lights cannot join
+    // a group and are only selected on their own
+    void applySelection() {
+        std::sort(pickedIds.begin(), pickedIds.end());
+        pickedIds.erase(std::unique(pickedIds.begin(), pickedIds.end()), pickedIds.end());
+        if (!request.additive) selectedObject.clear();
+
+        size_t objectsPicked = 0;
+        uint32_t lastObject = 0;
+        for (GLuint id : pickedIds) {
+            if (id == PICK_ID_NONE) continue;
+            uint32_t index = (id & ~PICK_ID_LIGHT_BIT) - 1;
+
+            if (id & PICK_ID_LIGHT_BIT) {
+                if (index >= sceneLights.size() || (request.marquee && selectedObject.isSelected())) continue;
+                selectedObject.select(SelectedObject::LIGHT, sceneLights.handle(index));
+                std::cout << "Selected Light Index: " << index << std::endl;
+            }
+            else if (index < sceneObjects.size()) {
+                EntityHandle handle = sceneObjects.handle(index);
+                if (selectedObject.type != SelectedObject::IMPORTED_OBJECT) selectedObject.select(SelectedObject::IMPORTED_OBJECT, handle);
+                else selectedObject.add(handle);
+                lastObject = index;
+                objectsPicked++;
+            }
+        }
+        if (objectsPicked == 1) std::cout << "Selected Imported Object Index: " << lastObject << std::endl;
+        else if (objectsPicked > 1) std::cout << "Selected " << objectsPicked << " objects" << std::endl;
+    }
+
+    GLuint pbo;
+    GLsync fence;
+    bool inFlight;
+    size_t pixelCount;
+    uint64_t objectLayoutVersion, lightLayoutVersion;
+    PickRequest request;
+    std::vector<GLuint> pickedIds;
+};
+
+IdBufferPicker idBufferPicker;
+
+// Blended over the opaque scene, so it only depth-tests against objects and never hides anything below the plane
+void renderGrid(const ShaderProgram& shaderProgram) {
+    glUseProgram(shaderProgram.id);
+    frameStats.stateChanges += 2;
+    glUniform3f(shaderProgram.location(Uniform::MAIN_LINE_COLOR), 0.0f, 0.0f, 0.0f);
+    glUniform3f(shaderProgram.location(Uniform::SECONDARY_LINE_COLOR), 0.5f, 0.5f, 0.5f);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDepthMask(GL_FALSE);
+
+    glBindVertexArray(fullscreenVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    frameStats.drawCalls++;
+
+    glBindVertexArray(0);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+}
+
+size_t visibleObjectCount = 0;
+
+float lodPixelError = 1.0f;
+bool lodHysteresis = true;
+const float LOD_HYSTERESIS = 0.25f;
+
+// Coarsest level whose simplification error projects to at most lodPixelError pixels
+int selectLodLevel(size_t object, float pixelsPerUnit) {
+    const MeshAsset& mesh = *sceneObjects.meshes[object];
+    glm::vec4 sphere = sceneObjects.worldBoundingSphere(object);
+    float distance = std::max(glm::length(glm::vec3(sphere) - cameraPos) - sphere.w, 0.1f);
+    float scale = mesh.bounds.sphereRadius > 0.0f ? sphere.w / mesh.bounds.sphereRadius : 1.0f;
+    float pixelsPerMeshUnit = pixelsPerUnit * scale / distance;
+
+    for (int level = static_cast<int>(mesh.lods.size()) - 1; level > 0; --level) {
+        float threshold = lodPixelError;
+        // Coarsening needs a margin below the threshold, so objects near a switch distance don't flicker
+        if (lodHysteresis && level > sceneObjects.lodLevels[object]) threshold *= 1.0f - LOD_HYSTERESIS;
+        if (mesh.lods[level].error * pixelsPerMeshUnit <= threshold) return level;
+    }
+    return 0;
+}
+
+bool depthPrepassEnabled = true;
+bool occlusionCullingEnabled = true;
+bool profilerVisible = false;
+
+// With the pre-pass, the lit pass runs with GL_EQUAL so the lighting shader only runs for the visible surface
+void renderObjects(Renderer& renderer, const ShaderProgram& shaderProgram, const ShaderProgram& depthShader, const ShaderProgram& occlusionShader,
+    const glm::mat4& viewProjection, const std::vector<uint32_t>& highlighted) {
+    glUseProgram(shaderProgram.id);
+    frameStats.stateChanges++;
+    glUniform3fv(shaderProgram.location(Uniform::OBJECT_COLOR), 1, glm::value_ptr(glm::vec3(1.0f, 0.5f, 0.31f)));
+
+    static std::vector<unsigned char> visible;
+    static std::vector<uint32_t> candidates;
+    static std::vector<size_t> tested;
+
+    // Rebuilds the world and normal matrices and bounding spheres of moved objects and their descendants
+    sceneObjects.updateTransforms();
+    cullBoundingSpheres(extractFrustum(viewProjection), sceneObjects.bounds(), visible);
+
+    // Pixels covered by one world unit at unit distance from the camera
+    float pixelsPerUnit = projection[1][1] * sceneFramebuffer.height * 0.5f;
+
+    if (occlusionCullingEnabled) occlusionCuller.resize(sceneObjects.size(), sceneObjects.layoutVersion());
+    else occlusionCuller.reset();
+
+    // Query results can only be read on the GL thread, so the occlusion test stays serial
+    candidates.clear();
+    tested.clear();
+    for (size_t i = 0; i < sceneObjects.size(); ++i) {
+        if (!visible[i] || !sceneObjects.meshes[i] || sceneObjects.meshes[i]->streamed) continue;
+        if (occlusionCullingEnabled) {
+            tested.push_back(i);
+            if (occlusionCuller.isOccluded(i)) {
+                frameStats.occludedObjects++;
+                continue;
+            }
+        }
+        candidates.push_back(static_cast<uint32_t>(i));
+    }
+
+    frameWorkers.parallelForRange(candidates.size(), FRAME_TASK_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; ++c) sceneObjects.lodLevels[candidates[c]] = selectLodLevel(candidates[c], pixelsPerUnit);
+    });
+    visibleObjectCount = candidates.size();
+    renderer.prepare(candidates, cameraPos, highlighted);
+
+    if (depthPrepassEnabled) {
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        renderer.draw(depthShader);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
+
+    fragmentCounter.begin();
+    renderer.draw(shaderProgram);
+    fragmentCounter.end();
+    frameStats.fragmentsShaded = fragmentCounter.count();
+
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+
+    if (occlusionCullingEnabled) occlusionCuller.issueQueries(occlusionShader, tested);
+}
+
+// std430 mirrors of the records in indirectCullComputeShaderSource
+struct IndirectObjectRecord {
+    glm::mat4 model;
+    glm::vec4 normalMatrix[3];
+    glm::vec4 sphere;
+    uint32_t mesh[4];
+};
+
+struct IndirectMeshRecord {
+    int32_t header[4];
+    uint32_t lods[MAX_MESH_LODS][4];
+};
+
+// Layout glMultiDrawElementsIndirect reads
+struct DrawElementsIndirectCommand {
+    GLuint count, instanceCount, firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+static_assert(MAX_MESH_LODS == 4, "The culling shader's MeshRecord holds four LOD levels");
+
+const GLuint INDIRECT_OBJECT_BINDING = 0, INDIRECT_MESH_BINDING = 1, INDIRECT_SLOT_BINDING = 2, INDIRECT_LOD_BINDING = 3, INDIRECT_COMMAND_BINDING = 4;
+const GLuint INDIRECT_OBJECT_INDEX_LOCATION = 2;
+const GLuint INDIRECT_CULL_GROUP_SIZE = 64;
+
+bool gpuDrivenEnabled = false;
+
+// Draws every object with one glMultiDrawElementsIndirect per vertex format and index type. Meshes are drawn
+// straight out of the mesh buffer pool's shared buffers, per-object data lives in a storage buffer that is only
+// rewritten for objects that moved, and a compute shader culls and picks LODs into the command buffer. The
+// CPU cost per frame is a handful of GL calls however many objects there are.
+class GpuDrivenRenderer {
+public:
+    GpuDrivenRenderer()
+        : objectBuffer(0), meshBuffer(0), slotBuffer(0), lodBuffer(0), commandBuffer(0), meshTableRevision(0), patchedMovesRevision(0),
+        layoutVersion(0), layoutSize(0), layoutValid(false), uploadedEpoch(0), uploadsPending(true) {
+        for (int format = 0; format < 2; ++format) formatVAOs[format] = boundBuffers[format][0] = boundBuffers[format][1] = 0;
+    }
+
+    bool setup() {
+        cullProgram = createComputeProgram(indirectCullComputeShaderSource);
+        if (!cullProgram.id) return false;
+
+        GLuint* buffers[] = { &objectBuffer, &meshBuffer, &slotBuffer, &lodBuffer, &commandBuffer };
+        for (GLuint* buffer : buffers) glGenBuffers(1, buffer);
+        return true;
+    }
+
+    // Brings the GPU copies up to date and fills the command buffer; draw() can then be called once per pass
+    void prepare(const glm::mat4& viewProjection, const std::vector<uint32_t>& highlighted) {
+        // The mesh table is indexed by live meshes, so it is rebuilt only when the pool released one or when moves
+        // were missed while this path was off; meshes that compaction moved just get their records rewritten
+        uint64_t movesRevision = meshBufferPool.movesRevision();
+        if (meshTableRevision != meshBufferPool.revision() || movesRevision > patchedMovesRevision + 1) {
+            meshRecords.clear();
+            meshBatches.clear();
+            meshTableRevision = meshBufferPool.revision();
+            layoutValid = false;
+        }
+        else if (movesRevision != patchedMovesRevision) {
+            patchMovedMeshes();
+        }
+        patchedMovesRevision = movesRevision;
+        for (int format = 0; format < 2; ++format) bindPoolAttributes(format);
+
+        sceneObjects.updateTransforms();
+        if (!layoutValid || sceneObjects.layoutVersion() != layoutVersion || sceneObjects.size() != layoutSize) rebuildLayout();
+        uploadObjects();
+
+        highlightedSlots.clear();
+        for (uint32_t object : highlighted) {
+            if (object < objectSlots.size() && objectSlots[object] != NO_OBJECT) highlightedSlots.push_back(objectSlots[object]);
+        }
+        std::sort(highlightedSlots.begin(), highlightedSlots.end());
+        if (slotObjects.empty()) return;
+
+        Frustum frustum = extractFrustum(viewProjection);
+        glUseProgram(cullProgram.id);
+        frameStats.stateChanges++;
+        glUniform4fv(cullProgram.location(Uniform::FRUSTUM_PLANES), 6, glm::value_ptr(frustum.planes[0]));
+        glUniform3fv(cullProgram.location(Uniform::EYE_POSITION), 1, glm::value_ptr(cameraPos));
+        glUniform1f(cullProgram.location(Uniform::PIXELS_PER_UNIT), projection[1][1] * sceneFramebuffer.height * 0.5f);
+        glUniform1f(cullProgram.location(Uniform::LOD_PIXEL_ERROR), lodPixelError);
+        glUniform1f(cullProgram.location(Uniform::LOD_HYSTERESIS), lodHysteresis ? LOD_HYSTERESIS : 0.0f);
+        glUniform1ui(cullProgram.location(Uniform::SLOT_COUNT), static_cast<GLuint>(slotObjects.size()));
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INDIRECT_OBJECT_BINDING, objectBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INDIRECT_MESH_BINDING, meshBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INDIRECT_SLOT_BINDING, slotBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INDIRECT_LOD_BINDING, lodBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INDIRECT_COMMAND_BINDING, commandBuffer);
+        glDispatchCompute(static_cast<GLuint>((slotObjects.size() + INDIRECT_CULL_GROUP_SIZE - 1) / INDIRECT_CULL_GROUP_SIZE), 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+    }
+
+    // Highlighted objects are cut out of their batches and drawn last, as the only ones writing 1 into the stencil
+    void draw(const ShaderProgram& shaderProgram) {
+        if (slotObjects.empty()) return;
+        glUseProgram(shaderProgram.id);
+        frameStats.stateChanges++;
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INDIRECT_OBJECT_BINDING, objectBuffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+
+        for (int batch = 0; batch < BATCH_COUNT; ++batch) {
+            size_t first = batchStarts[batch], end = batchStarts[batch + 1];
+            if (first == end) continue;
+
+            bindBatch(shaderProgram, batch);
+            auto highlight = std::lower_bound(highlightedSlots.begin(), highlightedSlots.end(), static_cast<uint32_t>(first));
+            for (; highlight != highlightedSlots.end() && *highlight < end; ++highlight) {
+                multiDraw(batch, first, *highlight);
+                first = *highlight + 1;
+            }
+            multiDraw(batch, first, end);
+        }
+
+        if (!highlightedSlots.empty()) {
+            glStencilFunc(GL_ALWAYS, 1, 0xFF);
+            glStencilMask(0xFF);
+            for (int batch = 0; batch < BATCH_COUNT; ++batch) {
+                auto highlight = std::lower_bound(highlightedSlots.begin(), highlightedSlots.end(), static_cast<uint32_t>(batchStarts[batch]));
+                if (highlight == highlightedSlots.end() || *highlight >= batchStarts[batch + 1]) continue;
+
+                bindBatch(shaderProgram, batch);
+                // Neighbouring highlighted slots go out as one multi-draw
+                while (highlight != highlightedSlots.end() && *highlight < batchStarts[batch + 1]) {
+                    auto run = highlight + 1;
+                    while (run != highlightedSlots.end() && *run == *(run - 1) + 1 && *run < batchStarts[batch + 1]) ++run;
+                    multiDraw(batch, *highlight, *(run - 1) + 1);
+                    highlight = run;
+                }
+            }
+            glStencilMask(0x00);
+        }
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    size_t submittedObjects() const { return slotObjects.size(); }
+
+private:
+    // A multi-draw cannot change vertex format or index type, so meshes are split into one batch per combination
+    static const int BATCH_COUNT = 4;
+
+    static int batchOf(const MeshAsset& mesh) {
+        return (mesh.vertexFormat == VertexFormat::COMPACT ? 2 : 0) + (mesh.indexType == GL_UNSIGNED_SHORT ? 1 : 0);
+    }
+    static VertexFormat batchVertexFormat(int batch) { return batch >= 2 ? VertexFormat::COMPACT : VertexFormat::FLOAT; }
+    static VertexFormat formatOf(int format) { return format ? VertexFormat::COMPACT : VertexFormat::FLOAT; }
+    static GLenum batchIndexType(int batch) { return (batch & 1) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT; }
+
+    void bindBatch(const ShaderProgram& shaderProgram, int batch) {
+        glUniform1i(shaderProgram.location(Uniform::OCTAHEDRAL_NORMALS), batchVertexFormat(batch) == VertexFormat::COMPACT ? 1 : 0);
+        glBindVertexArray(formatVAOs[batch / 2]);
+        frameStats.stateChanges++;
+    }
+
+    void multiDraw(int batch, size_t first, size_t end) {
+        if (first >= end) return;
+        glMultiDrawElementsIndirect(GL_TRIANGLES, batchIndexType(batch), (void*)(first * sizeof(DrawElementsIndirectCommand)), static_cast<GLsizei>(end - first), 0);
+        frameStats.drawCalls++;
+    }
+
+    // Points the format's VAO at the pool's current buffers; they change whenever the pool grows or trims a heap
+    void bindPoolAttributes(int format) {
+        GLuint vertexBuffer = meshBufferPool.vertexBuffer(formatOf(format)), indexBuffer = meshBufferPool.indexBuffer(formatOf(format));
+        if (!vertexBuffer || (vertexBuffer == boundBuffers[format][0] && indexBuffer == boundBuffers[format][1])) return;
+
+        if (!formatVAOs[format]) glGenVertexArrays(1, &formatVAOs[format]);
+        glBindVertexArray(formatVAOs[format]);
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        setupMeshVertexAttributes(formatOf(format));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+
+        // baseInstance is the slot, so with a divisor of 1 this reads slotObjects[slot]
+        glBindBuffer(GL_ARRAY_BUFFER, slotBuffer);
+        glVertexAttribIPointer(INDIRECT_OBJECT_INDEX_LOCATION, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+        glEnableVertexAttribArray(INDIRECT_OBJECT_INDEX_LOCATION);
+        glVertexAttribDivisor(INDIRECT_OBJECT_INDEX_LOCATION, 1);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        boundBuffers[format][0] = vertexBuffer;
+        boundBuffers[format][1] = indexBuffer;
+    }
+
+    // Adds a pooled mesh to the CPU copy of the mesh table; rebuildLayout() uploads the table once all new meshes are in
+    void registerMesh(MeshAsset& mesh) {
+        mesh.indirectMesh = static_cast<int>(meshRecords.size());
+        mesh.indirectRevision = meshTableRevision;
+        meshRecords.push_back(meshRecord(mesh));
+        meshBatches.push_back(batchOf(mesh));
+    }
+
+    // Re-uploads the records of registered meshes whose pool ranges moved this frame
+    void patchMovedMeshes() {
+        for (MeshAsset* mesh : meshBufferPool.movedMeshes()) {
+            if (mesh->indirectMesh < 0 || mesh->indirectRevision != meshTableRevision) continue;
+            IndirectMeshRecord& record = meshRecords[mesh->indirectMesh];
+            record = meshRecord(*mesh);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshBuffer);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, mesh->indirectMesh * sizeof(IndirectMeshRecord), sizeof(IndirectMeshRecord), &record);
+            frameStats.bytesUploaded += sizeof(IndirectMeshRecord);
+        }
+    }
+
+    // Points the mesh's LODs at its current ranges in the shared buffers
+    static IndirectMeshRecord meshRecord(const MeshAsset& mesh) {
+        IndirectMeshRecord record;
+        memset(&record, 0, sizeof(record));
+        unsigned int firstIndex = static_cast<unsigned int>(mesh.indexOffset / mesh.indexSize());
+        std::vector<MeshLod> lods = mesh.lods.empty() ? std::vector<MeshLod>(1, MeshLod(0, mesh.indexCount)) : mesh.lods;
+        record.header[0] = mesh.baseVertex();
+        record.header[1] = std::min(static_cast<int32_t>(lods.size()), static_cast<int32_t>(MAX_MESH_LODS));
+        memcpy(&record.header[2], &mesh.bounds.sphereRadius, sizeof(float));
+        for (int level = 0; level < record.header[1]; ++level) {
+            record.lods[level][0] = firstIndex + lods[level].firstIndex;
+            record.lods[level][1] = lods[level].indexCount;
+            memcpy(&record.lods[level][2], &lods[level].error, sizeof(float));
+        }
+        return record;
+    }
+
+    // Gives every drawable object a command slot, grouped by batch; only needed when objects are added or removed
+    void rebuildLayout() {
+        size_t count = sceneObjects.size();
+        objectSlots.assign(count, NO_OBJECT);
+        objectBatches.assign(count, -1);
+
+        size_t batchCounts[BATCH_COUNT] = {};
+        size_t registeredMeshes = meshRecords.size();
+        for (size_t i = 0; i < count; ++i) {
+            const std::shared_ptr<MeshAsset>& mesh = sceneObjects.meshes[i];
+            if (!mesh || mesh->indexCount == 0 || !mesh->VAO) continue;
+            if (mesh->indirectMesh < 0 || mesh->indirectRevision != meshTableRevision) registerMesh(*mesh);
+            objectBatches[i] = meshBatches[mesh->indirectMesh];
+            batchCounts[objectBatches[i]]++;
+        }
+        if (meshRecords.size() != registeredMeshes) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, meshRecords.size() * sizeof(IndirectMeshRecord), meshRecords.data(), GL_STATIC_DRAW);
+            frameStats.bytesUploaded += meshRecords.size() * sizeof(IndirectMeshRecord);
+        }
+
+        size_t cursor[BATCH_COUNT];
+        batchStarts[0] = 0;
+        for (int batch = 0; batch < BATCH_COUNT; ++batch) {
+            cursor[batch] = batchStarts[batch];
+            batchStarts[batch + 1] = batchStarts[batch] + batchCounts[batch];
+        }
+        slotObjects.resize(batchStarts[BATCH_COUNT]);
+        for (size_t i = 0; i < count; ++i) {
+            if (objectBatches[i] < 0) continue;
+            size_t slot = cursor[objectBatches[i]]++;
+            slotObjects[slot] = static_cast<uint32_t>(i);
+            objectSlots[i] = static_cast<uint32_t>(slot);
+        }
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, slotBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, slotObjects.size() * sizeof(uint32_t), slotObjects.data(), GL_STATIC_DRAW);
+        std::vector<uint32_t> lodLevels(count, 0);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, lodBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, lodLevels.size() * sizeof(uint32_t), lodLevels.data(), GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, slotObjects.size() * sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_COPY);
+
+        records.resize(count);
+        uploadedRevisions.assign(count, 0);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, records.size() * sizeof(IndirectObjectRecord), nullptr, GL_DYNAMIC_DRAW);
+
+        layoutVersion = sceneObjects.layoutVersion();
+        layoutSize = count;
+        layoutValid = true;
+        uploadsPending = true;
+    }
+
+    // Rewrites the records of objects whose world transform changed and uploads the dirty span
+    void uploadObjects() {
+        if (!uploadsPending && sceneObjects.transformEpoch() == uploadedEpoch) return;
+
+        size_t count = records.size();
+        size_t rangeCount = (count + FRAME_TASK_GRAIN - 1) / FRAME_TASK_GRAIN;
+        dirtyRanges.assign(rangeCount, std::make_pair(count, size_t(0)));
+        bool everything = uploadsPending;
+        frameWorkers.parallelForRange(count, FRAME_TASK_GRAIN, [&](size_t begin, size_t end) {
+            std::pair<size_t, size_t>& dirty = dirtyRanges[begin / FRAME_TASK_GRAIN];
+            for (size_t i = begin; i < end; ++i) {
+                if (!everything && sceneObjects.revision(i) == uploadedRevisions[i]) continue;
+                uploadedRevisions[i] = sceneObjects.revision(i);
+
+                IndirectObjectRecord& record = records[i];
+                const std::shared_ptr<MeshAsset>& mesh = sceneObjects.meshes[i];
+                record.model = mesh ? sceneObjects.worldMatrix(i) * mesh->positionDecode : sceneObjects.worldMatrix(i);
+                const glm::mat3& normalMatrix = sceneObjects.normalMatrix(i);
+                for (int column = 0; column < 3; ++column) record.normalMatrix[column] = glm::vec4(normalMatrix[column], 0.0f);
+                record.sphere = sceneObjects.worldBoundingSphere(i);
+                record.mesh[0] = mesh && mesh->indirectMesh >= 0 ? static_cast<uint32_t>(mesh->indirectMesh) : 0;
+                record.mesh[1] = record.mesh[2] = record.mesh[3] = 0;
+
+                dirty.first = std::min(dirty.first, i);
+                dirty.second = i + 1;
+            }
+        });
+
+        size_t first = count, end = 0;
+        for (const auto& dirty : dirtyRanges) {
+            first = std::min(first, dirty.first);
+            end = std::max(end, dirty.second);
+        }
+        if (first < end) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(IndirectObjectRecord), (end - first) * sizeof(IndirectObjectRecord), &records[first]);
+            frameStats.bytesUploaded += (end - first) * sizeof(IndirectObjectRecord);
+        }
+        uploadedEpoch = sceneObjects.transformEpoch();
+        uploadsPending = false;
+    }
+
+    ShaderProgram cullProgram;
+    GLuint objectBuffer, meshBuffer, slotBuffer, lodBuffer, commandBuffer;
+    // One VAO per vertex format over the pool's buffers, and the buffers it was last pointed at
+    GLuint formatVAOs[2], boundBuffers[2][2];
+    std::vector<IndirectMeshRecord> meshRecords;
+    uint64_t meshTableRevision, patchedMovesRevision;
+    std::vector<int> meshBatches;
+
+    uint64_t layoutVersion;
+    size_t layoutSize;
+    bool layoutValid;
+    size_t batchStarts[BATCH_COUNT + 1];
+    std::vector<uint32_t> slotObjects, objectSlots;
+    std::vector<int> objectBatches;
+
+    uint64_t uploadedEpoch;
+    bool uploadsPending;
+    std::vector<IndirectObjectRecord> records;
+    std::vector<unsigned int> uploadedRevisions;
+    std::vector<std::pair<size_t, size_t>> dirtyRanges;
+    std::vector<uint32_t> highlightedSlots;
+};
+
+GpuDrivenRenderer gpuDrivenRenderer;
+
+// Same passes as renderObjects, with culling and LOD selection moved to the GPU; occlusion queries are not used
+void renderObjectsIndirect(const ShaderProgram& shaderProgram, const ShaderProgram& depthShader, const glm::mat4& viewProjection, const std::vector<uint32_t>& highlighted) {
+    glUseProgram(shaderProgram.id);
+    glUniform3fv(shaderProgram.location(Uniform::OBJECT_COLOR), 1, glm::value_ptr(glm::vec3(1.0f, 0.5f, 0.31f)));
+
+    gpuDrivenRenderer.prepare(viewProjection, highlighted);
+    visibleObjectCount = gpuDrivenRenderer.submittedObjects();
+
+    if (depthPrepassEnabled) {
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        gpuDrivenRenderer.draw(depthShader);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
+
+    fragmentCounter.begin();
+    gpuDrivenRenderer.draw(shaderProgram);
+    fragmentCounter.end();
+    frameStats.fragmentsShaded = fragmentCounter.count();
+
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+}
+
+// GPU memory for resident streamed chunks. Every slot fits the largest possible chunk, so this is about 380 slots
+const size_t STREAM_POOL_BYTES = 256 * 1024 * 1024;
+const size_t STREAM_VERTEX_SLOT_BYTES = STREAM_CHUNK_MAX_VERTICES * sizeof(CompactVertex);
+const size_t STREAM_INDEX_SLOT_BYTES = STREAM_CHUNK_MAX_TRIANGLES * 3 * sizeof(uint16_t);
+const size_t STREAM_UPLOAD_BUDGET_BYTES_PER_FRAME = 8 * 1024 * 1024;
+// Chunks whose bounding sphere covers fewer pixels than this are drawn if resident but never paged in
+const float STREAM_MIN_CHUNK_PIXELS = 4.0f;
+
+// Pages the chunks of streamed meshes through one fixed-size vertex and index buffer. Each frame the visible
+// chunks are found by frustum-testing their bounds; missing ones are requested largest on screen first, get their
+// file pages prefetched, and are copied in a frame later within an upload budget. When no slot is free the chunk
+// drawn least recently is evicted, so GPU memory never exceeds STREAM_POOL_BYTES however large the file is.
+class ChunkStreamer {
+public:
+    ChunkStreamer()
+        : vao(0), vertexBuffer(0), indexBuffer(0), instanceBuffer(0), instanceCapacity(0), frame(0), batchedCount(0),
+        visibleChunks(0), missingChunks(0) {}
+
+    void setup() {
+        size_t slotCount = STREAM_POOL_BYTES / (STREAM_VERTEX_SLOT_BYTES + STREAM_INDEX_SLOT_BYTES);
+        slots.assign(slotCount, Slot());
+        for (size_t i = slotCount; i-- > 0;) freeSlots.push_back(static_cast<int32_t>(i));
+
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vertexBuffer);
+        glGenBuffers(1, &indexBuffer);
+        glGenBuffers(1, &instanceBuffer);
+
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, slotCount * STREAM_VERTEX_SLOT_BYTES, nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, slotCount * STREAM_INDEX_SLOT_BYTES, nullptr, GL_DYNAMIC_DRAW);
+        setupMeshVertexAttributes(VertexFormat::COMPACT);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Decides what is visible, pages in what is missing and uploads the instance data; highlighted holds sorted
+    // dense indices of the selected objects
+    void prepare(const glm::mat4& viewProjection, const std::vector<uint32_t>& highlighted) {
+        frame++;
+        drawList.clear();
+        highlightList.clear();
+        requests.clear();
+        visibleChunks = 0;
+        if (slots.empty()) return;
+
+        Frustum frustum = extractFrustum(viewProjection);
+        float pixelsPerUnit = projection[1][1] * sceneFramebuffer.height * 0.5f;
+        sceneObjects.updateTransforms();
+
+        for (size_t i = 0; i < sceneObjects.size(); ++i) {
+            const std::shared_ptr<MeshAsset>& mesh = sceneObjects.meshes[i];
+            if (!mesh || !mesh->streamed) continue;
+
+            StreamedMesh& streamed = *mesh->streamed;
+            const glm::mat4& world = sceneObjects.worldMatrix(i);
+            float scale = std::max(glm::length(glm::vec3(world[0])), std::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+            bool highlight = std::binary_search(highlighted.begin(), highlighted.end(), static_cast<uint32_t>(i));
+
+            for (uint32_t c = 0; c < streamed.chunks.size(); ++c) {
+                if (streamed.slots[c] == STREAM_CHUNK_INVALID) continue;
+                const MeshBounds& bounds = streamed.chunks[c].bounds;
+                glm::vec3 center = glm::vec3(world * glm::vec4(bounds.sphereCenter, 1.0f));
+                float radius = bounds.sphereRadius * scale;
+                if (!sphereInFrustum(frustum, center, radius)) continue;
+
+                visibleChunks++;
+                float distance = std::max(glm::length(center - cameraPos) - radius, 0.1f);
+                ChunkRef ref = { &streamed, c, static_cast<uint32_t>(i), distance, radius * pixelsPerUnit / distance, highlight };
+                if (streamed.slots[c] >= 0) use(ref);
+                else if (ref.pixels >= STREAM_MIN_CHUNK_PIXELS) requests.push_back(ref);
+            }
+        }
+
+        std::sort(requests.begin(), requests.end(), [](const ChunkRef& a, const ChunkRef& b) { return a.pixels > b.pixels; });
+        pageIn();
+        missingChunks = visibleChunks - drawList.size() - highlightList.size();
 
-        newObject.indexCount = static_cast<int>(indices.size());
-        importedObjects.push_back(newObject);
+        auto nearToFar = [](const ChunkRef& a, const ChunkRef& b) { return a.distance < b.distance; };
+        std::sort(drawList.begin(), drawList.end(), nearToFar);
+        std::sort(highlightList.begin(), highlightList.end(), nearToFar);
+        batchedCount = drawList.size();
+        drawList.insert(drawList.end(), highlightList.begin(), highlightList.end());
+        uploadInstances();
     }
 
-    std::cout << "Imported " << scene->mNumMeshes << " mesh(es) from " << filePath << std::endl;
-}
+    // The highlighted objects' chunks are drawn last and are the only ones that write 1 into the stencil buffer
+    void draw(const ShaderProgram& shaderProgram) {
+        if (drawList.empty()) return;
+        glUseProgram(shaderProgram.id);
+        glUniform1i(shaderProgram.location(Uniform::OCTAHEDRAL_NORMALS), 1);
+        glBindVertexArray(vao);
+        frameStats.stateChanges += 2;
 
-void openImportDialog() {
-    const char* filters[] = { "*.obj", "*.fbx", "*.gltf", "*.dae" };
-    const char* filePath = tinyfd_openFileDialog(
-        "Select Model File",
-        "",
-        4, filters,
-        "Supported Model Files",
-        0
-    );
+        drawChunks(0, batchedCount);
+        if (batchedCount < drawList.size()) {
+            glStencilFunc(GL_ALWAYS, 1, 0xFF);
+            glStencilMask(0xFF);
+            drawChunks(batchedCount, drawList.size());
+            glStencilMask(0x00);
+        }
 
-    if (filePath) {
-        importObject(filePath);
+        glBindVertexArray(0);
     }
-}
-
-void renderOutline(const ImportedObject& obj, GLuint outlineShader, const glm::mat4& view, const glm::mat4& projection) {
-    glEnable(GL_STENCIL_TEST);
-    glStencilMask(0x00);
-    glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
-    glDisable(GL_DEPTH_TEST);
 
-    glUseProgram(outlineShader);
+    bool hasDraws() const { return !drawList.empty(); }
+    size_t slotCount() const { return slots.size(); }
+    size_t residentChunkCount() const { return slots.size() - freeSlots.size(); }
+    size_t visibleChunkCount() const { return visibleChunks; }
+    // Visible chunks not drawn this frame because they are still being paged in or were too small to request
+    size_t missingChunkCount() const { return missingChunks; }
+
+private:
+    struct ChunkRef {
+        StreamedMesh* mesh;
+        uint32_t chunk, object;
+        float distance, pixels;
+        bool highlighted;
+    };
 
-    glm::mat4 model = glm::translate(glm::mat4(1.0f), obj.position);
-    model = glm::rotate(model, glm::radians(obj.rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-    model = glm::rotate(model, glm::radians(obj.rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-    model = glm::rotate(model, glm::radians(obj.rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-    model = glm::scale(model, obj.scale * 0.985f);
+    // A resident chunk keeps its mesh, and with it the mapped file, alive until it is evicted
+    struct Slot {
+        std::shared_ptr<StreamedMesh> mesh;
+        uint32_t chunk;
+        uint64_t lastUsedFrame;
+        Slot() : chunk(0), lastUsedFrame(0) {}
+    };
 
-    glUniformMatrix4fv(glGetUniformLocation(outlineShader, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(glGetUniformLocation(outlineShader, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(outlineShader, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-    glUniform3f(glGetUniformLocation(outlineShader, "outlineColor"), 1.0f, 1.0f, 0.0f);
+    void use(const ChunkRef& ref) {
+        slots[ref.mesh->slots[ref.chunk]].lastUsedFrame = frame;
+        (ref.highlighted ? highlightList : drawList).push_back(ref);
+    }
 
-    glBindVertexArray(obj.VAO);
-    glDrawElements(GL_TRIANGLES, obj.indexCount, GL_UNSIGNED_INT, nullptr);
-    glBindVertexArray(0);
+    // Uploads happen the frame after a chunk's pages were prefetched, so the copy rarely waits on the disk.
+    // At least one chunk is copied per frame even when it alone exceeds the budget.
+    void pageIn() {
+        size_t uploaded = 0;
+        for (const ChunkRef& ref : requests) {
+            StreamedMesh& mesh = *ref.mesh;
+            const MeshStreamChunk& chunk = mesh.chunks[ref.chunk];
+            // The same chunk is requested once per instance of its mesh
+            if (mesh.slots[ref.chunk] >= 0) {
+                use(ref);
+                continue;
+            }
 
-    glEnable(GL_DEPTH_TEST);
-    glStencilMask(0xFF);
-    glDisable(GL_STENCIL_TEST);
-}
+            size_t vertexBytes = size_t(chunk.vertexCount) * sizeof(CompactVertex);
+            size_t indexBytes = size_t(chunk.indexCount) * sizeof(uint16_t);
+            if (mesh.prefetchFrames[ref.chunk] == 0) {
+                mesh.file->prefetch(static_cast<size_t>(chunk.vertexOffset), vertexBytes);
+                mesh.file->prefetch(static_cast<size_t>(chunk.indexOffset), indexBytes);
+                mesh.prefetchFrames[ref.chunk] = frame;
+                continue;
+            }
+            if (mesh.prefetchFrames[ref.chunk] == frame) continue;
+            if (uploaded > 0 && uploaded + vertexBytes + indexBytes > STREAM_UPLOAD_BUDGET_BYTES_PER_FRAME) break;
+
+            int32_t slot = acquireSlot();
+            if (slot < 0) break;
+
+            // Indices are checked against the chunk while they are copied anyway, so a corrupt file cannot make
+            // the GPU read outside the slot
+            const char* base = mesh.file->data();
+            const uint16_t* indices = reinterpret_cast<const uint16_t*>(base + chunk.indexOffset);
+            bool valid = true;
+            for (uint32_t i = 0; i < chunk.indexCount && valid; ++i) valid = indices[i] < chunk.vertexCount;
+            if (!valid) {
+                mesh.slots[ref.chunk] = STREAM_CHUNK_INVALID;
+                freeSlots.push_back(slot);
+                continue;
+            }
 
-float calculateLOD(const glm::vec3& cameraPos, float baseScale = 1.0f, float maxScale = 10.0f) {
-    float distance = glm::length(cameraPos);
-    return glm::clamp(baseScale * (distance / 10.0f), baseScale, maxScale);
-}
+            glBindBuffer(GL_COPY_WRITE_BUFFER, vertexBuffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, size_t(slot) * STREAM_VERTEX_SLOT_BYTES, vertexBytes, base + chunk.vertexOffset);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, size_t(slot) * STREAM_INDEX_SLOT_BYTES, indexBytes, indices);
+            mesh.file->release(static_cast<size_t>(chunk.vertexOffset), vertexBytes);
+            mesh.file->release(static_cast<size_t>(chunk.indexOffset), indexBytes);
+            frameStats.bytesUploaded += vertexBytes + indexBytes;
+            uploaded += vertexBytes + indexBytes;
+
+            slots[slot].mesh = sceneObjects.meshes[ref.object]->streamed;
+            slots[slot].chunk = ref.chunk;
+            mesh.slots[ref.chunk] = slot;
+            use(ref);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
 
-void renderObjects(GLuint shaderProgram, const glm::mat4& view, const glm::mat4& projection) {
-    glUseProgram(shaderProgram);
+    // A free slot, or the least recently drawn one that is not in use this frame; -1 if every slot is
+    int32_t acquireSlot() {
+        if (!freeSlots.empty()) {
+            int32_t slot = freeSlots.back();
+            freeSlots.pop_back();
+            return slot;
+        }
 
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-    glUniform3fv(glGetUniformLocation(shaderProgram, "viewPosition"), 1, glm::value_ptr(cameraPos));
+        int32_t victim = -1;
+        uint64_t oldest = frame;
+        for (size_t i = 0; i < slots.size(); ++i) {
+            if (slots[i].lastUsedFrame < oldest) {
+                oldest = slots[i].lastUsedFrame;
+                victim = static_cast<int32_t>(i);
+            }
+        }
+        if (victim < 0) return -1;
 
-    glUniform1i(glGetUniformLocation(shaderProgram, "numLights"), sceneLights.size());
-    for (size_t i = 0; i < sceneLights.size(); i++) {
-        const std::string prefix = "lights[" + std::to_string(i) + "].";
-        const Light& light = sceneLights[i];
-        glUniform3fv(glGetUniformLocation(shaderProgram, (prefix + "position").c_str()), 1, glm::value_ptr(light.position));
-        glUniform3fv(glGetUniformLocation(shaderProgram, (prefix + "direction").c_str()), 1, glm::value_ptr(light.direction));
-        glUniform3fv(glGetUniformLocation(shaderProgram, (prefix + "color").c_str()), 1, glm::value_ptr(light.color));
-        glUniform1f(glGetUniformLocation(shaderProgram, (prefix + "brightness").c_str()), light.brightness);
-        glUniform1f(glGetUniformLocation(shaderProgram, (prefix + "cutOff").c_str()), glm::cos(glm::radians(light.cutOff)));
-        glUniform1f(glGetUniformLocation(shaderProgram, (prefix + "outerCutOff").c_str()), glm::cos(glm::radians(light.outerCutOff)));
-        glUniform1f(glGetUniformLocation(shaderProgram, (prefix + "constant").c_str()), 1.0f);
-        glUniform1f(glGetUniformLocation(shaderProgram, (prefix + "linear").c_str()), 0.09f);
-        glUniform1f(glGetUniformLocation(shaderProgram, (prefix + "quadratic").c_str()), 0.032f);
+        Slot& slot = slots[victim];
+        slot.mesh->slots[slot.chunk] = STREAM_CHUNK_NOT_RESIDENT;
+        slot.mesh->prefetchFrames[slot.chunk] = 0;
+        slot.mesh.reset();
+        return victim;
     }
 
-    for (const auto& obj : importedObjects) {
-        if (obj.indexCount == 0) continue;
-
-        glm::mat4 model = glm::translate(glm::mat4(1.0f), obj.position);
-        model = glm::rotate(model, glm::radians(obj.rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-        model = glm::rotate(model, glm::radians(obj.rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-        model = glm::rotate(model, glm::radians(obj.rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-        model = glm::scale(model, obj.scale);
-
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-        glUniform3fv(glGetUniformLocation(shaderProgram, "objectColor"), 1, glm::value_ptr(glm::vec3(1.0f, 0.5f, 0.31f)));
+    void uploadInstances() {
+        instances.resize(drawList.size());
+        for (size_t i = 0; i < drawList.size(); ++i) {
+            const ChunkRef& ref = drawList[i];
+            instances[i].model = sceneObjects.worldMatrix(ref.object) * positionDecodeMatrix(ref.mesh->chunks[ref.chunk].bounds);
+            instances[i].normalMatrix = sceneObjects.normalMatrix(ref.object);
+            instances[i].pickId = ref.object + 1;
+        }
+        if (instances.empty()) return;
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        size_t bytes = instances.size() * sizeof(InstanceData);
+        if (bytes > instanceCapacity) instanceCapacity = std::max(bytes, instanceCapacity * 2);
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity, nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, instances.data());
+        frameStats.bytesUploaded += bytes;
+    }
 
-        glBindVertexArray(obj.VAO);
-        glDrawElements(GL_TRIANGLES, obj.indexCount, GL_UNSIGNED_INT, nullptr);
+    // Each chunk has its own decode matrix, so chunks are drawn one at a time with the instance attributes
+    // pointed at their entry
+    void drawChunks(size_t first, size_t end) {
+        for (size_t i = first; i < end; ++i) {
+            const ChunkRef& ref = drawList[i];
+            int32_t slot = ref.mesh->slots[ref.chunk];
+            GLsizei indexCount = static_cast<GLsizei>(ref.mesh->chunks[ref.chunk].indexCount);
+            bindInstanceAttributes(instanceBuffer, i * sizeof(InstanceData));
+            glDrawElementsBaseVertex(GL_TRIANGLES, indexCount, GL_UNSIGNED_SHORT, (void*)(size_t(slot) * STREAM_INDEX_SLOT_BYTES),
+                static_cast<GLint>(size_t(slot) * STREAM_CHUNK_MAX_VERTICES));
+            frameStats.drawCalls++;
+            frameStats.triangles += indexCount / 3;
+        }
     }
 
-    glBindVertexArray(0);
-}
+    GLuint vao, vertexBuffer, indexBuffer, instanceBuffer;
+    size_t instanceCapacity;
+    uint64_t frame;
+    std::vector<Slot> slots;
+    std::vector<int32_t> freeSlots;
+    std::vector<ChunkRef> drawList, highlightList, requests;
+    std::vector<InstanceData> instances;
+    size_t batchedCount, visibleChunks, missingChunks;
+};
 
-void renderLightCube(GLuint shaderProgram, const glm::mat4& view, const glm::mat4& projection) {
-    glUseProgram(shaderProgram);
+ChunkStreamer chunkStreamer;
 
-    for (const auto& light : sceneLights) {
-        glm::mat4 model = glm::translate(glm::mat4(1.0f), light.position);
-        model = glm::scale(model, glm::vec3(0.2f));
+// Drawn after the other objects with a plain depth test; streamed chunks take no part in the depth pre-pass or
+// the occlusion queries
+void renderStreamedObjects(const ShaderProgram& shaderProgram, const glm::mat4& viewProjection, const std::vector<uint32_t>& highlighted) {
+    chunkStreamer.prepare(viewProjection, highlighted);
+    if (!chunkStreamer.hasDraws()) return;
 
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniform3fv(glGetUniformLocation(shaderProgram, "lightColor"), 1, glm::value_ptr(light.color));
+    glUseProgram(shaderProgram.id);
+    glUniform3fv(shaderProgram.location(Uniform::OBJECT_COLOR), 1, glm::value_ptr(glm::vec3(1.0f, 0.5f, 0.31f)));
+    chunkStreamer.draw(shaderProgram);
+}
 
-        glBindVertexArray(lightCubeVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-    }
+void renderLightCube(const ShaderProgram& shaderProgram) {
+    if (lightInstanceCount == 0) return;
 
+    glUseProgram(shaderProgram.id);
+    glBindVertexArray(lightCubeVAO);
+    frameStats.stateChanges += 2;
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 36, lightInstanceCount);
+    frameStats.drawCalls++;
+    frameStats.triangles += 12ull * lightInstanceCount;
     glBindVertexArray(0);
 }
 
@@ -760,71 +6016,180 @@ void renderSelectedObjectPanel() {
     ImGui::SetNextWindowSize({ OBJECT_PROPERTIES_PANEL_WIDTH, WINDOW_HEIGHT });
     ImGui::Begin("Object Properties", nullptr, ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove);
 
+    // A handle whose entity was removed no longer resolves, so a stale selection just shows nothing
+    uint32_t index = 0;
     if (selectedObject.isSelected()) {
-        if (selectedObject.type == SelectedObject::IMPORTED_OBJECT &&
-            selectedObject.index >= 0 && selectedObject.index < static_cast<int>(importedObjects.size())) {
-
-            auto& obj = importedObjects[selectedObject.index];
+        if (selectedObject.type == SelectedObject::IMPORTED_OBJECT && sceneObjects.resolve(selectedObject.handle, index)) {
+            glm::vec3& position = sceneObjects.positions[index];
+            glm::vec3& rotation = sceneObjects.rotations[index];
+            glm::vec3& scale = sceneObjects.scales[index];
 
             if (ImGui::CollapsingHeader("Position")) {
-                ImGui::DragFloat3("Position", &obj.position.x, 0.1f, -100.0f, 100.0f);
+                if (ImGui::DragFloat3("Position", &position.x, 0.1f, -100.0f, 100.0f)) {
+                    sceneObjects.markTransformDirty(index);
+                }
                 if (ImGui::Button("Reset Position")) {
-                    obj.position = glm::vec3(0.0f);
+                    position = glm::vec3(0.0f);
+                    sceneObjects.markTransformDirty(index);
                 }
             }
 
             if (ImGui::CollapsingHeader("Rotation")) {
-                ImGui::DragFloat("Rotate X", &obj.rotation.x, 0.1f, -FLT_MAX, FLT_MAX);
-                ImGui::DragFloat("Rotate Y", &obj.rotation.y, 0.1f, -FLT_MAX, FLT_MAX);
-                ImGui::DragFloat("Rotate Z", &obj.rotation.z, 0.1f, -FLT_MAX, FLT_MAX);
+                bool rotationChanged = ImGui::DragFloat("Rotate X", &rotation.x, 0.1f, -FLT_MAX, FLT_MAX);
+                rotationChanged |= ImGui::DragFloat("Rotate Y", &rotation.y, 0.1f, -FLT_MAX, FLT_MAX);
+                rotationChanged |= ImGui::DragFloat("Rotate Z", &rotation.z, 0.1f, -FLT_MAX, FLT_MAX);
                 if (ImGui::Button("Reset Rotation")) {
-                    obj.rotation = glm::vec3(0.0f);
+                    rotation = glm::vec3(0.0f);
+                    rotationChanged = true;
+                }
+                if (rotationChanged) {
+                    sceneObjects.markTransformDirty(index);
                 }
             }
 
             if (ImGui::CollapsingHeader("Scale")) {
-                ImGui::DragFloat3("Scale", &obj.scale.x, 0.1f, 0.1f, 100.0f);
+                if (ImGui::DragFloat3("Scale", &scale.x, 0.1f, 0.1f, 100.0f)) {
+                    sceneObjects.markTransformDirty(index);
+                }
                 if (ImGui::Button("Reset Scale")) {
-                    obj.scale = glm::vec3(1.0f);
+                    scale = glm::vec3(1.0f);
+                    sceneObjects.markTransformDirty(index);
                 }
             }
+
+            ImGui::Separator();
+            EntityHandle parent = sceneObjects.parent(index);
+            if (sceneObjects.contains(parent) && ImGui::Button("Select Parent")) {
+                selectedObject.select(SelectedObject::IMPORTED_OBJECT, parent);
+            }
+            ImGui::Text("Children: %u", sceneObjects.childCount(index));
+            if (ImGui::Button("Delete Object")) {
+                sceneObjects.remove(selectedObject.handle);
+                selectedObject.clear();
+            }
         }
-        else if (selectedObject.type == SelectedObject::LIGHT &&
-             selectedObject.index >= 0 && selectedObject.index < static_cast<int>(sceneLights.size())) {
+        else if (selectedObject.type == SelectedObject::LIGHT && sceneLights.resolve(selectedObject.handle, index)) {
 
-             auto& light = sceneLights[selectedObject.index];
+             auto& light = sceneLights[index];
 
              if (ImGui::CollapsingHeader("Light Position")) {
-                 ImGui::DragFloat3("Position", &light.position.x, 0.1f, -100.0f, 100.0f);
+                 sceneLightsDirty |= ImGui::DragFloat3("Position", &light.position.x, 0.1f, -100.0f, 100.0f);
                  if (ImGui::Button("Reset Position")) {
                      light.position = glm::vec3(0.0f);
+                     sceneLightsDirty = true;
                  }
              }
              if (ImGui::CollapsingHeader("Light Direction")) {
-                 ImGui::DragFloat3("Direction", &light.direction.x, 0.1f, -1.0f, 1.0f);
+                 sceneLightsDirty |= ImGui::DragFloat3("Direction", &light.direction.x, 0.1f, -1.0f, 1.0f);
                  if (ImGui::Button("Reset Direction")) {
                      light.direction = glm::vec3(0.0f);
+                     sceneLightsDirty = true;
                  }
              }
 			 if (ImGui::CollapsingHeader("Light Color")) {
-				 ImGui::ColorEdit3("Color", &light.color.x);
+				 sceneLightsDirty |= ImGui::ColorEdit3("Color", &light.color.x);
 			 }
 			 if (ImGui::CollapsingHeader("CutOffs")) {
-                 ImGui::SliderAngle("CutOff", &light.cutOff, 0.0f, 45.0f);
-                 ImGui::SliderAngle("Outer CutOff", &light.outerCutOff, 45.0f, 90.0f);
+                 sceneLightsDirty |= ImGui::SliderAngle("CutOff", &light.cutOff, 0.0f, 45.0f);
+                 sceneLightsDirty |= ImGui::SliderAngle("Outer CutOff", &light.outerCutOff, 45.0f, 90.0f);
 			 }
              if (ImGui::CollapsingHeader("Brightness Slider")) {
-                 ImGui::SliderFloat("Brightness", &light.brightness, 0.0f, 10.0f);
+                 sceneLightsDirty |= ImGui::SliderFloat("Brightness", &light.brightness, 0.0f, 10.0f);
              }
+             if (ImGui::CollapsingHeader("Shadows")) {
+                 ImGui::Checkbox("Cast shadows", &light.castsShadows);
+                 ImGui::Text("Shadow map: %d px", shadowAtlas.tileSize(index));
+             }
+
+             ImGui::Separator();
+             if (ImGui::Button("Delete Light")) {
+                 sceneLights.remove(selectedObject.handle);
+                 sceneLightsDirty = true;
+                 selectedObject.clear();
+             }
+        }
+        else {
+            selectedObject.clear();
         }
     }
-    else {
+    if (!selectedObject.isSelected()) {
         ImGui::Text("No object selected.");
     }
 
     ImGui::End();
 }
 
+// Capacity, live and free bytes of each shared buffer in the mesh pool, and how splintered the free space is
+void renderMeshPoolStats() {
+    static const char* const HEAP_NAMES[] = { "Float vertices", "Float indices", "Compact vertices", "Compact indices" };
+    if (!ImGui::BeginTable("MeshPool", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) return;
+    ImGui::TableSetupColumn("Buffer");
+    ImGui::TableSetupColumn("Size MB");
+    ImGui::TableSetupColumn("Live MB");
+    ImGui::TableSetupColumn("Free MB");
+    ImGui::TableSetupColumn("Holes");
+    ImGui::TableSetupColumn("Frag.");
+    ImGui::TableHeadersRow();
+
+    for (int heap = 0; heap < 4; ++heap) {
+        MeshBufferPool::HeapStats stats = meshBufferPool.stats(heap);
+        if (stats.capacityBytes == 0) continue;
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("%s", HEAP_NAMES[heap]);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.2f", stats.capacityBytes / (1024.0 * 1024.0));
+        ImGui::TableNextColumn();
+        ImGui::Text("%.2f", stats.usedBytes / (1024.0 * 1024.0));
+        ImGui::TableNextColumn();
+        ImGui::Text("%.2f", (stats.capacityBytes - stats.usedBytes) / (1024.0 * 1024.0));
+        ImGui::TableNextColumn();
+        ImGui::Text("%zu", stats.freeBlocks);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.0f%%", stats.fragmentation * 100.0f);
+    }
+    ImGui::EndTable();
+}
+
+void renderMeshMemoryReport() {
+    if (!ImGui::CollapsingHeader("Mesh Memory")) return;
+    renderMeshPoolStats();
+    if (loadedModels.empty()) return;
+
+    size_t totalBytes = 0, totalUncompressedBytes = 0;
+    if (ImGui::BeginTable("MeshMemory", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+        ImGui::TableSetupColumn("Mesh");
+        ImGui::TableSetupColumn("Vertices");
+        ImGui::TableSetupColumn("GPU KB");
+        ImGui::TableSetupColumn("Saved KB");
+        ImGui::TableSetupColumn("ACMR");
+        ImGui::TableHeadersRow();
+
+        for (const auto& model : loadedModels) {
+            std::string fileName = model.first.substr(model.first.find_last_of("/\\") + 1);
+            for (size_t i = 0; i < model.second.meshes.size(); ++i) {
+                const MeshAsset& mesh = *model.second.meshes[i];
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::Text("%s #%zu", fileName.c_str(), i);
+                ImGui::TableNextColumn();
+                ImGui::Text("%d", mesh.vertexCount);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.1f", mesh.gpuBytes() / 1024.0);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.1f", (mesh.uncompressedBytes() - mesh.gpuBytes()) / 1024.0);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.2f > %.2f", mesh.acmrBefore, mesh.acmrAfter);
+
+                totalBytes += mesh.gpuBytes();
+                totalUncompressedBytes += mesh.uncompressedBytes();
+            }
+        }
+        ImGui::EndTable();
+    }
+    ImGui::Text("Total: %.2f MB, saved %.2f MB", totalBytes / (1024.0 * 1024.0), (totalUncompressedBytes - totalBytes) / (1024.0 * 1024.0));
+}
+
 void renderObjectListPanel() {
     ImGui::SetNextWindowPos({ OBJECT_PROPERTIES_PANEL_WIDTH + VIEWPORT_WIDTH, 0 });
     ImGui::SetNextWindowSize({ OBJECT_LIST_PANEL_WIDTH, WINDOW_HEIGHT });
@@ -835,32 +6200,99 @@ void renderObjectListPanel() {
     }
     ImGui::SameLine();
     if (ImGui::Button("Add Light")) {
-        sceneLights.emplace_back();
+        sceneLights.create();
+        sceneLightsDirty = true;
+    }
+    ImGui::Checkbox("Compact vertices", &importSettings.compactVertices);
+    ImGui::SameLine();
+    ImGui::Checkbox("Optimize meshes", &importSettings.optimizeMeshes);
+    ImGui::Checkbox("Generate LODs", &importSettings.generateLods);
+    ImGui::SameLine();
+    ImGui::Checkbox("Hysteresis", &lodHysteresis);
+    ImGui::SliderFloat("LOD error (px)", &lodPixelError, 0.0f, 8.0f, "%.1f");
+    ImGui::Checkbox("Depth pre-pass", &depthPrepassEnabled);
+    ImGui::SameLine();
+    ImGui::Checkbox("Occlusion culling", &occlusionCullingEnabled);
+    ImGui::Checkbox("Shadows", &shadowsEnabled);
+    ImGui::SameLine();
+    if (ImGui::Checkbox("ID-buffer picking", &idBufferPicking)) marqueeDrag.active = false;
+    ImGui::Checkbox("Profiler", &profilerVisible);
+    if (gpuDrivenSupported) {
+        ImGui::SameLine();
+        ImGui::Checkbox("GPU-driven (GL 4.3)", &gpuDrivenEnabled);
+    }
+    else {
+        ImGui::TextDisabled("GPU-driven rendering needs OpenGL 4.3");
+    }
+
+    if (!importJobs.empty()) {
+        ImGui::Separator();
+        ImGui::Text("Importing:");
+        for (const auto& job : importJobs) {
+            ImGui::PushID(job.get());
+            std::string fileName = job->filePath.substr(job->filePath.find_last_of("/\\") + 1);
+            ImGui::TextUnformatted(fileName.c_str());
+
+            if (job->state == ImportJob::UPLOADING) {
+                unsigned int meshCount = job->meshCount;
+                std::string overlay = "Uploading " + std::to_string(job->meshesUploaded) + "/" + std::to_string(meshCount);
+                ImGui::ProgressBar(meshCount ? static_cast<float>(job->meshesUploaded) / meshCount : 1.0f, ImVec2(-60.0f, 0.0f), overlay.c_str());
+            }
+            else {
+                ImGui::ProgressBar(job->parseProgress, ImVec2(-60.0f, 0.0f), job->state == ImportJob::QUEUED ? "Queued" : "Parsing");
+            }
+
+            ImGui::SameLine();
+            if (ImGui::SmallButton("Cancel")) {
+                job->cancelRequested = true;
+            }
+            ImGui::PopID();
+        }
     }
 
     static char searchFilter[64] = "";
     ImGui::InputText("Search", searchFilter, sizeof(searchFilter));
     ImGui::Separator();
 
-    ImGui::Text("Scene Objects:");
-    for (size_t i = 0; i < importedObjects.size(); ++i) {
-        if (strstr(("Imported Object " + std::to_string(i)).c_str(), searchFilter)) {
-            bool isSelected = (selectedObject.type == SelectedObject::IMPORTED_OBJECT && selectedObject.index == static_cast<int>(i));
-            if (ImGui::Selectable(("Imported Object " + std::to_string(i)).c_str(), isSelected)) {
-                selectedObject.type = SelectedObject::IMPORTED_OBJECT;
-                selectedObject.index = static_cast<int>(i);
+    bool gpuDriven = gpuDrivenEnabled && gpuDrivenSupported;
+    if (gpuDriven) {
+        // Culling and LOD selection happen on the GPU, so only the submitted objects are known here
+        ImGui::Text("Scene Objects: %zu submitted of %zu, culled on the GPU", visibleObjectCount, sceneObjects.size());
+        ImGui::Text("Draw calls: %u", frameStats.drawCalls);
+    }
+    else {
+        ImGui::Text("Scene Objects: %zu visible of %zu", visibleObjectCount, sceneObjects.size());
+        ImGui::Text("Triangles: %llu in %u draw calls", frameStats.triangles, frameStats.drawCalls);
+    }
+    ImGui::Text("Occluded: %zu, fragments shaded: %llu", frameStats.occludedObjects, frameStats.fragmentsShaded);
+    if (chunkStreamer.residentChunkCount() > 0 || chunkStreamer.visibleChunkCount() > 0) {
+        ImGui::Text("Streamed chunks: %zu visible, %zu missing, %zu of %zu slots resident", chunkStreamer.visibleChunkCount(),
+            chunkStreamer.missingChunkCount(), chunkStreamer.residentChunkCount(), chunkStreamer.slotCount());
+    }
+    // Entries are named after the handle slot, which stays put when other objects are deleted
+    for (size_t i = 0; i < sceneObjects.size(); ++i) {
+        EntityHandle handle = sceneObjects.handle(i);
+        std::string label = (sceneObjects.meshes[i] ? "Imported Object " : "Group ") + std::to_string(handle.slot);
+        if (strstr(label.c_str(), searchFilter)) {
+            bool isSelected = selectedObject.contains(handle);
+            if (ImGui::Selectable(label.c_str(), isSelected)) {
+                selectedObject.select(SelectedObject::IMPORTED_OBJECT, handle);
             }
         }
     }
 
+    renderMeshMemoryReport();
+
     ImGui::Separator();
-    ImGui::Text("Lights:");
+    ImGui::Text("Lights: %zu (at most %u per cluster)", sceneLights.size(), lightClusters.maxLightsPerCluster);
+    ImGui::Text("Shadow maps: %zu, %u re-rendered", shadowAtlas.shadowedLightCount(), frameStats.shadowMapsRendered);
     for (size_t i = 0; i < sceneLights.size(); ++i) {
-        if (strstr(("Light " + std::to_string(i)).c_str(), searchFilter)) {
-            bool isSelected = (selectedObject.type == SelectedObject::LIGHT && selectedObject.index == static_cast<int>(i));
-            if (ImGui::Selectable(("Light " + std::to_string(i)).c_str(), isSelected)) {
-                selectedObject.type = SelectedObject::LIGHT;
-                selectedObject.index = static_cast<int>(i);
+        EntityHandle handle = sceneLights.handle(i);
+        std::string label = "Light " + std::to_string(handle.slot);
+        if (strstr(label.c_str(), searchFilter)) {
+            bool isSelected = (selectedObject.type == SelectedObject::LIGHT && selectedObject.handle == handle);
+            if (ImGui::Selectable(label.c_str(), isSelected)) {
+                selectedObject.select(SelectedObject::LIGHT, handle);
             }
         }
     }
@@ -868,26 +6300,55 @@ void renderObjectListPanel() {
     ImGui::End();
 }
 
-int main() {
-    GLFWwindow* window = initGLFW();
-    if (!window) return -1;
-
-    IMGUI_CHECKVERSION();
-    ImGui::CreateContext();
-    ImGui_ImplGlfw_InitForOpenGL(window, true);
-    ImGui_ImplOpenGL3_Init("#version 330");
+void renderMarquee(GLFWwindow* window) {
+    if (!marqueeDrag.active) return;
+    double mouseX, mouseY;
+    glfwGetCursorPos(window, &mouseX, &mouseY);
+    ImVec2 start(static_cast<float>(marqueeDrag.startX), static_cast<float>(marqueeDrag.startY));
+    ImVec2 end(static_cast<float>(mouseX), static_cast<float>(mouseY));
+    ImDrawList* drawList = ImGui::GetForegroundDrawList();
+    drawList->AddRectFilled(start, end, IM_COL32(255, 255, 0, 40));
+    drawList->AddRect(start, end, IM_COL32(255, 255, 0, 255));
+}
 
-    GLuint cubeShader = createShaderProgram(vertexShaderSource, fragmentShaderSource);
-    GLuint gridShader = createShaderProgram(gridVertexShaderSource, gridFragmentShaderSource);
-    GLuint outlineShader = createShaderProgram(outlineVertexShaderSource, outlineFragmentShaderSource);
-    GLuint lightCubeShader = createShaderProgram(lightCubeVertexShaderSource, lightCubeFragmentShaderSource);
+struct SceneShaders {
+    ShaderProgram object, depthOnly, shadow, occlusionBox, grid, lightCube, selectionMask, composite;
+    ShaderProgram indirectObject, indirectDepthOnly;
+};
 
-    glfwSetMouseButtonCallback(window, mouseButtonCallback);
-    glfwSetScrollCallback(window, scrollCallback);
+void setupLitShaderSamplers(const ShaderProgram& shader) {
+    glUseProgram(shader.id);
+    glUniform1i(shader.location(Uniform::LIGHT_DATA), LIGHT_DATA_TEXTURE_UNIT);
+    glUniform1i(shader.location(Uniform::CLUSTER_GRID), CLUSTER_GRID_TEXTURE_UNIT);
+    glUniform1i(shader.location(Uniform::CLUSTER_LIGHT_INDICES), CLUSTER_LIGHT_INDEX_TEXTURE_UNIT);
+    glUniform1i(shader.location(Uniform::SHADOW_ATLAS), SHADOW_ATLAS_TEXTURE_UNIT);
+    glUniform1i(shader.location(Uniform::SHADOW_DATA), SHADOW_DATA_TEXTURE_UNIT);
+}
 
-    float gridScale = calculateLOD(cameraPos);
-    setupGrid(gridScale);
+SceneShaders createSceneShaders() {
+    SceneShaders shaders;
+    shaders.object = createShaderProgram(vertexShaderSource, fragmentShaderSource);
+    shaders.depthOnly = createShaderProgram(vertexShaderSource, depthOnlyFragmentShaderSource);
+    shaders.shadow = createShaderProgram(shadowVertexShaderSource, depthOnlyFragmentShaderSource);
+    shaders.occlusionBox = createShaderProgram(occlusionBoxVertexShaderSource, depthOnlyFragmentShaderSource);
+    shaders.grid = createShaderProgram(gridVertexShaderSource, gridFragmentShaderSource);
+    shaders.lightCube = createShaderProgram(lightCubeVertexShaderSource, lightCubeFragmentShaderSource);
+    shaders.selectionMask = createShaderProgram(fullscreenVertexShaderSource, selectionMaskFragmentShaderSource);
+    shaders.composite = createShaderProgram(fullscreenVertexShaderSource, compositeFragmentShaderSource);
+
+    setupLitShaderSamplers(shaders.object);
+
+    // The indirect vertex shader needs GL 4.3, so these stay empty on the fallback path
+    if (gpuDrivenSupported) {
+        shaders.indirectObject = createShaderProgram(indirectVertexShaderSource, fragmentShaderSource);
+        shaders.indirectDepthOnly = createShaderProgram(indirectVertexShaderSource, depthOnlyFragmentShaderSource);
+        setupLitShaderSamplers(shaders.indirectObject);
+    }
+    glUseProgram(0);
+    return shaders;
+}
 
+void setupLightCube() {
     float cubeVertices[] = {         
         -0.5f, -0.5f, -0.5f,
          0.5f, -0.5f, -0.5f,
@@ -941,74 +6402,694 @@ int main() {
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
+    setupLightCubeInstances();
+}
+
+enum ScenePass {
+    PASS_GRID,
+    PASS_LIGHTS,
+    PASS_OBJECTS,
+    PASS_RESOLVE,
+    PASS_SHADOWS,
+    PASS_COUNT
+};
+
+const char* const SCENE_PASS_NAMES[PASS_COUNT] = { "grid", "lights", "objects", "resolve", "shadows" };
+
+// Optional per-pass timing hooks; the benchmark harness uses them to wrap each pass in CPU and GPU timers
+struct PassTimer {
+    virtual ~PassTimer() {}
+    virtual void begin(ScenePass pass) = 0;
+    virtual void end(ScenePass pass) = 0;
+};
+
+void renderScene(const SceneShaders& shaders, Renderer& renderer, const glm::mat4& view, GLuint outputFramebuffer, int outputX, int outputY, PassTimer* timer = nullptr) {
+    frameStats = FrameStats();
+
+    updateCameraBuffer(view, projection);
+    updateLightBuffer();
+    updateLightClusters(view, sceneFramebuffer.width, sceneFramebuffer.height);
+
+    if (timer) timer->begin(PASS_SHADOWS);
+    shadowAtlas.update(shaders.shadow, extractFrustum(projection * view), projection[1][1] * sceneFramebuffer.height * 0.5f, shadowsEnabled);
+    if (timer) timer->end(PASS_SHADOWS);
+
+    beginScenePass();
+    if (timer) timer->begin(PASS_LIGHTS);
+    renderLightCube(shaders.lightCube);
+    if (timer) timer->end(PASS_LIGHTS);
+
+    // Dense indices of every selected object that still exists, sorted for the renderers' lookups
+    static std::vector<uint32_t> highlighted;
+    highlighted.clear();
+    uint32_t index;
+    if (selectedObject.type == SelectedObject::IMPORTED_OBJECT && sceneObjects.resolve(selectedObject.handle, index)) highlighted.push_back(index);
+    for (EntityHandle handle : selectedObject.group) {
+        if (sceneObjects.resolve(handle, index)) highlighted.push_back(index);
+    }
+    std::sort(highlighted.begin(), highlighted.end());
+    highlighted.erase(std::unique(highlighted.begin(), highlighted.end()), highlighted.end());
+    if (timer) timer->begin(PASS_OBJECTS);
+    if (gpuDrivenEnabled && gpuDrivenSupported) renderObjectsIndirect(shaders.indirectObject, shaders.indirectDepthOnly, projection * view, highlighted);
+    else renderObjects(renderer, shaders.object, shaders.depthOnly, shaders.occlusionBox, projection * view, highlighted);
+    renderStreamedObjects(shaders.object, projection * view, highlighted);
+    if (timer) timer->end(PASS_OBJECTS);
+
+    if (idBufferPicking) idBufferPicker.capture();
+    setIdBufferWrites(false);
+
+    if (timer) timer->begin(PASS_GRID);
+    renderGrid(shaders.grid);
+    if (timer) timer->end(PASS_GRID);
+
+    if (timer) timer->begin(PASS_RESOLVE);
+    resolveScenePass(shaders.selectionMask, shaders.composite, outputFramebuffer, outputX, outputY);
+    if (timer) timer->end(PASS_RESOLVE);
+}
+
+// Frames of GL timer queries in flight per scope; a result is read this many frames after it was issued
+const int PROFILER_QUERY_FRAMES = 4;
+// Frames kept for the overlay's graphs and averages
+const int PROFILER_HISTORY = 240;
+// A recorded trace stops growing here, roughly a few minutes of frames
+const size_t PROFILER_MAX_TRACE_EVENTS = 1 << 20;
+
+// Named CPU scopes, each optionally timed on the GPU with a GL_TIME_ELAPSED query, plus the draw statistics
+// collected inside them. Queries rotate through a ring PROFILER_QUERY_FRAMES deep and are only read once
+// available, so profiling never stalls the pipeline; a result still pending when its slot comes round again is
+// dropped. Only one GPU scope can be open at a time, since GL timer queries cannot nest.
+class FrameProfiler : public PassTimer {
+public:
+    FrameProfiler() : frameNumber(0), frameActive(false), enabled(false), recording(false), openGpuScope(-1), frameCpuHistory(PROFILER_HISTORY, 0.0f), frameGpuHistory(PROFILER_HISTORY, 0.0f) {}
+
+    void setup() {
+        sessionStart = std::chrono::steady_clock::now();
+        for (int pass = 0; pass < PASS_COUNT; ++pass) passScopes[pass] = scope(SCENE_PASS_NAMES[pass], true);
+    }
+
+    // Returns the id of the named scope, registering it the first time
+    int scope(const char* name, bool gpuTimed) {
+        for (size_t i = 0; i < scopes.size(); ++i) {
+            if (scopes[i].name == name) return static_cast<int>(i);
+        }
+        scopes.push_back(Scope(name, gpuTimed));
+        if (gpuTimed) glGenQueries(PROFILER_QUERY_FRAMES, scopes.back().queries);
+        return static_cast<int>(scopes.size() - 1);
+    }
+
+    void beginFrame() {
+        collectGpuResults();
+        frameActive = enabled || recording;
+        if (!frameActive) return;
+
+        frameNumber++;
+        frameGpuHistory[historySlot(frameNumber)] = 0.0f;
+        for (Scope& s : scopes) {
+            s.cpuHistory[historySlot(frameNumber)] = 0.0f;
+            s.gpuHistory[historySlot(frameNumber)] = 0.0f;
+            s.lastFrameStats = s.frameStats;
+            s.frameStats = FrameStats();
+        }
+        frameStart = std::chrono::steady_clock::now();
+    }
+
+    void endFrame() {
+        if (!frameActive) return;
+        auto now = std::chrono::steady_clock::now();
+        frameCpuHistory[historySlot(frameNumber)] = static_cast<float>(std::chrono::duration<double, std::milli>(now - frameStart).count());
+        if (recording) record(-1, false, microseconds(frameStart), microseconds(now) - microseconds(frameStart));
+        frameActive = false;
+    }
+
+    void beginScope(int id) {
+        if (!frameActive) return;
+        Scope& s = scopes[id];
+        s.cpuStart = std::chrono::steady_clock::now();
+        s.statsStart = frameStats;
+
+        if (s.gpuTimed && openGpuScope < 0) {
+            int ring = static_cast<int>(frameNumber % PROFILER_QUERY_FRAMES);
+            // The previous result in this slot never arrived in time; it is dropped rather than waited for
+            s.queryPending[ring] = false;
+            glBeginQuery(GL_TIME_ELAPSED, s.queries[ring]);
+            s.queryFrame[ring] = frameNumber;
+            s.queryStartUs[ring] = microseconds(s.cpuStart);
+            openGpuScope = id;
+        }
+    }
+
+    void endScope(int id) {
+        if (!frameActive) return;
+        Scope& s = scopes[id];
+        if (openGpuScope == id) {
+            glEndQuery(GL_TIME_ELAPSED);
+            s.queryPending[frameNumber % PROFILER_QUERY_FRAMES] = true;
+            openGpuScope = -1;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        s.cpuHistory[historySlot(frameNumber)] += static_cast<float>(std::chrono::duration<double, std::milli>(now - s.cpuStart).count());
+        // Scopes never span renderScene's reset of frameStats, so the difference is what ran inside them
+        const FrameStats& start = s.statsStart;
+        s.frameStats.drawCalls += frameStats.drawCalls - start.drawCalls;
+        s.frameStats.triangles += frameStats.triangles - start.triangles;
+        s.frameStats.stateChanges += frameStats.stateChanges - start.stateChanges;
+        s.frameStats.bytesUploaded += frameStats.bytesUploaded - start.bytesUploaded;
+        if (recording) record(id, false, microseconds(s.cpuStart), microseconds(now) - microseconds(s.cpuStart));
+    }
+
+    void begin(ScenePass pass) override { beginScope(passScopes[pass]); }
+    void end(ScenePass pass) override { endScope(passScopes[pass]); }
+
+    void setEnabled(bool on) { enabled = on; }
+    bool isRecording() const { return recording; }
+    size_t recordedEvents() const { return trace.size(); }
+
+    void startRecording() {
+        trace.clear();
+        recording = true;
+    }
+
+    void stopRecording() { recording = false; }
+
+    // Chrome trace-event JSON, viewable in chrome://tracing or Perfetto. GPU events sit on their own track at the
+    // time their scope was submitted, since GL_TIME_ELAPSED only measures durations.
+    bool writeTrace(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out) {
+            std::cerr << "Failed to open trace output: " << path << std::endl;
+            return false;
+        }
+
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+        for (const TraceEvent& event : trace) {
+            const char* name = event.scope < 0 ? "frame" : scopes[event.scope].name.c_str();
+            out << ",\n{\"name\":\"" << name << "\",\"cat\":\"" << (event.gpu ? "gpu" : "cpu") << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << (event.gpu ? 2 : 1)
+                << ",\"ts\":" << std::fixed << std::setprecision(3) << event.startUs << ",\"dur\":" << event.durationUs << "}";
+        }
+        out << "\n]}\n";
+        std::cout << "Wrote " << trace.size() << " trace events to " << path << std::endl;
+        return true;
+    }
+
+    void renderOverlay(bool* open) {
+        ImGui::SetNextWindowPos({ OBJECT_PROPERTIES_PANEL_WIDTH + 10.0f, 10.0f }, ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowSize({ 520.0f, 0.0f }, ImGuiCond_FirstUseEver);
+        if (!ImGui::Begin("Profiler", open)) {
+            ImGui::End();
+            return;
+        }
+
+        // The overlay is built mid-frame, so averages start at the last finished frame; GPU results lag further
+        // behind, so GPU averages also skip the frames whose queries may still be in flight
+        int frames = static_cast<int>(std::min<uint64_t>(frameNumber, PROFILER_HISTORY)) - 1;
+        int gpuFrames = std::max(frames - PROFILER_QUERY_FRAMES, 0);
+        int offset = static_cast<int>((frameNumber + 1) % PROFILER_HISTORY);
+        ImGui::Text("Frame: %.2f ms CPU, %.2f ms GPU (average of %d frames)", average(frameCpuHistory, 1, frames), average(frameGpuHistory, PROFILER_QUERY_FRAMES + 1, gpuFrames), std::max(frames, 0));
+        ImGui::PlotLines("CPU ms", frameCpuHistory.data(), PROFILER_HISTORY, offset, nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 50.0f));
+        ImGui::PlotLines("GPU ms", frameGpuHistory.data(), PROFILER_HISTORY, offset, nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 50.0f));
+
+        if (ImGui::BeginTable("ProfilerScopes", 7, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+            const char* headers[] = { "Scope", "CPU ms", "GPU ms", "Draws", "Triangles", "State", "Uploaded" };
+            for (const char* header : headers) ImGui::TableSetupColumn(header);
+            ImGui::TableHeadersRow();
+            for (const Scope& s : scopes) {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(s.name.c_str());
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", average(s.cpuHistory, 1, frames));
+                ImGui::TableNextColumn();
+                if (s.gpuTimed) ImGui::Text("%.3f", average(s.gpuHistory, PROFILER_QUERY_FRAMES + 1, gpuFrames));
+                else ImGui::TextUnformatted("-");
+                ImGui::TableNextColumn();
+                ImGui::Text("%u", s.lastFrameStats.drawCalls);
+                ImGui::TableNextColumn();
+                ImGui::Text("%llu", s.lastFrameStats.triangles);
+                ImGui::TableNextColumn();
+                ImGui::Text("%u", s.lastFrameStats.stateChanges);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.1f KB", s.lastFrameStats.bytesUploaded / 1024.0);
+            }
+            ImGui::EndTable();
+        }
+
+        static char tracePath[256] = "frame_trace.json";
+        if (recording) {
+            if (ImGui::Button("Stop Recording")) stopRecording();
+            ImGui::SameLine();
+            ImGui::Text("%zu events", trace.size());
+        }
+        else if (ImGui::Button("Record Trace")) {
+            startRecording();
+        }
+        ImGui::InputText("Trace file", tracePath, sizeof(tracePath));
+        if (ImGui::Button("Export Trace") && !trace.empty()) writeTrace(tracePath);
+        ImGui::End();
+    }
+
+private:
+    struct Scope {
+        std::string name;
+        bool gpuTimed;
+        std::vector<float> cpuHistory, gpuHistory;
+        // Counted during the current frame, the previous frame and since the scope was last opened
+        FrameStats frameStats, lastFrameStats, statsStart;
+        std::chrono::steady_clock::time_point cpuStart;
+        GLuint queries[PROFILER_QUERY_FRAMES];
+        bool queryPending[PROFILER_QUERY_FRAMES];
+        uint64_t queryFrame[PROFILER_QUERY_FRAMES];
+        double queryStartUs[PROFILER_QUERY_FRAMES];
+
+        Scope(const char* scopeName, bool gpu) : name(scopeName), gpuTimed(gpu), cpuHistory(PROFILER_HISTORY, 0.0f), gpuHistory(PROFILER_HISTORY, 0.0f) {
+            for (int i = 0; i < PROFILER_QUERY_FRAMES; ++i) {
+                queries[i] = 0;
+                queryPending[i] = false;
+                queryFrame[i] = 0;
+                queryStartUs[i] = 0.0;
+            }
+        }
+    };
+
+    // scope is -1 for the whole frame
+    struct TraceEvent {
+        int scope;
+        bool gpu;
+        double startUs, durationUs;
+    };
+
+    static int historySlot(uint64_t frame) { return static_cast<int>(frame % PROFILER_HISTORY); }
+
+    double microseconds(std::chrono::steady_clock::time_point time) const {
+        return std::chrono::duration<double, std::micro>(time - sessionStart).count();
+    }
+
+    // Mean of the count frames ending skip frames before the newest one
+    float average(const std::vector<float>& history, int skip, int count) const {
+        if (count <= 0) return 0.0f;
+        double total = 0.0;
+        for (int i = 0; i < count; ++i) total += history[historySlot(frameNumber + PROFILER_HISTORY * 2 - skip - i)];
+        return static_cast<float>(total / count);
+    }
+
+    void record(int scopeId, bool gpu, double startUs, double durationUs) {
+        if (trace.size() >= PROFILER_MAX_TRACE_EVENTS) {
+            std::cerr << "Trace buffer full, recording stopped after " << trace.size() << " events" << std::endl;
+            recording = false;
+            return;
+        }
+        trace.push_back(TraceEvent{ scopeId, gpu, startUs, durationUs });
+    }
+
+    void collectGpuResults() {
+        for (size_t id = 0; id < scopes.size(); ++id) {
+            Scope& s = scopes[id];
+            for (int ring = 0; ring < PROFILER_QUERY_FRAMES; ++ring) {
+                if (!s.queryPending[ring]) continue;
+                GLint available = 0;
+                glGetQueryObjectiv(s.queries[ring], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available) continue;
+
+                GLuint64 elapsed = 0;
+                glGetQueryObjectui64v(s.queries[ring], GL_QUERY_RESULT, &elapsed);
+                s.queryPending[ring] = false;
+                // Results older than the history window have nowhere to go
+                if (frameNumber - s.queryFrame[ring] >= PROFILER_HISTORY) continue;
+
+                float ms = static_cast<float>(elapsed / 1.0e6);
+                s.gpuHistory[historySlot(s.queryFrame[ring])] += ms;
+                frameGpuHistory[historySlot(s.queryFrame[ring])] += ms;
+                if (recording) record(static_cast<int>(id), true, s.queryStartUs[ring], elapsed / 1.0e3);
+            }
+        }
+    }
+
+    std::vector<Scope> scopes;
+    int passScopes[PASS_COUNT];
+    uint64_t frameNumber;
+    bool frameActive, enabled, recording;
+    int openGpuScope;
+    std::chrono::steady_clock::time_point sessionStart, frameStart;
+    std::vector<float> frameCpuHistory, frameGpuHistory;
+    std::vector<TraceEvent> trace;
+};
+
+FrameProfiler frameProfiler;
+
+struct LaunchOptions {
+    bool headless, gpuDriven;
+    std::vector<std::string> scenePaths;
+    int frameCount;
+    std::string outputPath;
+    // Records a profiler trace for the whole interactive session and writes it on exit
+    std::string tracePath;
+    // Models to convert into .meshstream files next to them; the program exits once they are written
+    std::vector<std::string> streamBuildPaths;
+    // Threads converting meshes during import, including the import thread itself; 0 picks one per core
+    int importThreads;
+    bool useMeshCache;
+
+    LaunchOptions() : headless(false), gpuDriven(false), frameCount(300), outputPath("benchmark.csv"), importThreads(0), useMeshCache(true) {}
+};
+
+LaunchOptions parseLaunchOptions(int argc, char** argv) {
+    LaunchOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--headless") options.headless = true;
+        else if (arg == "--gpu-driven") options.gpuDriven = true;
+        else if (arg == "--scene" && hasValue) options.scenePaths.push_back(argv[++i]);
+        else if (arg == "--frames" && hasValue) options.frameCount = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--output" && hasValue) options.outputPath = argv[++i];
+        else if (arg == "--trace" && hasValue) options.tracePath = argv[++i];
+        else if (arg == "--build-stream" && hasValue) options.streamBuildPaths.push_back(argv[++i]);
+        else if (arg == "--import-threads" && hasValue) options.importThreads = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--no-mesh-cache") options.useMeshCache = false;
+        else std::cerr << "Ignoring unknown argument: " << arg << std::endl;
+    }
+    return options;
+}
+
+struct BenchmarkFrame {
+    double cpuMs, pickMs;
+    double cpuPassMs[PASS_COUNT], gpuPassMs[PASS_COUNT];
+    unsigned int drawCalls;
+    unsigned long long triangles;
+    size_t visibleObjects;
+};
+
+class BenchmarkPassTimer : public PassTimer {
+public:
+    explicit BenchmarkPassTimer(int frameCount) : frame(0), queries(frameCount * PASS_COUNT) {
+        glGenQueries(static_cast<GLsizei>(queries.size()), queries.data());
+    }
+
+    ~BenchmarkPassTimer() {
+        glDeleteQueries(static_cast<GLsizei>(queries.size()), queries.data());
+    }
+
+    void beginFrame(int frameIndex, BenchmarkFrame& record) {
+        frame = frameIndex;
+        current = &record;
+    }
+
+    void begin(ScenePass pass) override {
+        glBeginQuery(GL_TIME_ELAPSED, queries[frame * PASS_COUNT + pass]);
+        passStart = std::chrono::high_resolution_clock::now();
+    }
+
+    void end(ScenePass pass) override {
+        current->cpuPassMs[pass] = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - passStart).count();
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+
+    // Called once after the run so that reading the results never stalls a measured frame
+    void resolve(std::vector<BenchmarkFrame>& frames) {
+        for (size_t f = 0; f < frames.size(); ++f) {
+            for (int pass = 0; pass < PASS_COUNT; ++pass) {
+                GLuint64 elapsed = 0;
+                glGetQueryObjectui64v(queries[f * PASS_COUNT + pass], GL_QUERY_RESULT, &elapsed);
+                frames[f].gpuPassMs[pass] = elapsed / 1.0e6;
+            }
+        }
+    }
+
+private:
+    int frame;
+    BenchmarkFrame* current;
+    std::chrono::high_resolution_clock::time_point passStart;
+    std::vector<GLuint> queries;
+};
+
+void writeBenchmarkReport(const std::string& path, const std::vector<BenchmarkFrame>& frames) {
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "Failed to open benchmark output: " << path << std::endl;
+        return;
+    }
+
+    bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    if (json) {
+        out << "{\n  \"frames\": [\n";
+    }
+    else {
+        out << "frame,cpu_ms,pick_ms";
+        for (int pass = 0; pass < PASS_COUNT; ++pass) out << ",cpu_" << SCENE_PASS_NAMES[pass] << "_ms";
+        for (int pass = 0; pass < PASS_COUNT; ++pass) out << ",gpu_" << SCENE_PASS_NAMES[pass] << "_ms";
+        out << ",gpu_ms,draw_calls,triangles,visible_objects\n";
+    }
+
+    for (size_t f = 0; f < frames.size(); ++f) {
+        const BenchmarkFrame& frame = frames[f];
+        double gpuMs = 0.0;
+        for (int pass = 0; pass < PASS_COUNT; ++pass) gpuMs += frame.gpuPassMs[pass];
+
+        if (json) {
+            out << "    { \"frame\": " << f << ", \"cpu_ms\": " << frame.cpuMs << ", \"pick_ms\": " << frame.pickMs;
+            for (int pass = 0; pass < PASS_COUNT; ++pass) out << ", \"cpu_" << SCENE_PASS_NAMES[pass] << "_ms\": " << frame.cpuPassMs[pass];
+            for (int pass = 0; pass < PASS_COUNT; ++pass) out << ", \"gpu_" << SCENE_PASS_NAMES[pass] << "_ms\": " << frame.gpuPassMs[pass];
+            out << ", \"gpu_ms\": " << gpuMs << ", \"draw_calls\": " << frame.drawCalls << ", \"triangles\": " << frame.triangles
+                << ", \"visible_objects\": " << frame.visibleObjects << " }" << (f + 1 < frames.size() ? "," : "") << "\n";
+        }
+        else {
+            out << f << "," << frame.cpuMs << "," << frame.pickMs;
+            for (int pass = 0; pass < PASS_COUNT; ++pass) out << "," << frame.cpuPassMs[pass];
+            for (int pass = 0; pass < PASS_COUNT; ++pass) out << "," << frame.gpuPassMs[pass];
+            out << "," << gpuMs << "," << frame.drawCalls << "," << frame.triangles << "," << frame.visibleObjects << "\n";
+        }
+    }
+
+    if (json) out << "  ]\n}\n";
+}
+
+int runBenchmark(const LaunchOptions& options, const SceneShaders& shaders, Renderer& renderer) {
+    auto importStart = std::chrono::steady_clock::now();
+    uint64_t importBytes = 0;
+    for (const auto& path : options.scenePaths) {
+        uint64_t size = 0;
+        if (getFileSize(path, size)) importBytes += size;
+        importJobs.push_back(importQueue.enqueue(path, importSettings));
+    }
+    while (!importJobs.empty()) {
+        processImportUploads(std::numeric_limits<size_t>::max());
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    double importSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - importStart).count();
+    double importMegabytes = importBytes / (1024.0 * 1024.0);
+    std::cout << "Scene import: " << importMegabytes << " MB in " << importSeconds << " s, "
+        << (importSeconds > 0.0 ? importMegabytes / importSeconds : 0.0) << " MB/s with " << importWorkers.threadCount()
+        << " import thread(s)" << (importSettings.useMeshCache ? "" : ", mesh cache off") << std::endl;
+
+    glm::vec3 sceneMin(-1.0f), sceneMax(1.0f);
+    sceneObjects.updateTransforms();
+    for (size_t i = 0; i < sceneObjects.size(); ++i) {
+        if (!sceneObjects.meshes[i]) continue;
+        glm::vec4 sphere = sceneObjects.worldBoundingSphere(i);
+        sceneMin = glm::min(sceneMin, glm::vec3(sphere) - glm::vec3(sphere.w));
+        sceneMax = glm::max(sceneMax, glm::vec3(sphere) + glm::vec3(sphere.w));
+    }
+    glm::vec3 sceneCenter = (sceneMin + sceneMax) * 0.5f;
+    float orbitRadius = glm::length(sceneMax - sceneMin) * 0.75f;
+
+    GLuint outputFramebuffer, outputTexture;
+    outputTexture = createRenderTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, VIEWPORT_WIDTH, VIEWPORT_HEIGHT);
+    glGenFramebuffers(1, &outputFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, outputTexture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    std::vector<BenchmarkFrame> frames(options.frameCount);
+    BenchmarkPassTimer timer(options.frameCount);
+
+    for (int f = 0; f < options.frameCount; ++f) {
+        // Scripted path: one full orbit around the scene, bobbing up and down
+        float angle = glm::radians(360.0f) * f / options.frameCount;
+        cameraPos = sceneCenter + glm::vec3(std::cos(angle) * orbitRadius, orbitRadius * (0.35f + 0.25f * std::sin(angle * 2.0f)), std::sin(angle) * orbitRadius);
+        cameraTarget = sceneCenter;
+        cameraFront = glm::normalize(cameraTarget - cameraPos);
+        glm::mat4 view = glm::lookAt(cameraPos, cameraTarget, cameraUp);
+
+        BenchmarkFrame& record = frames[f];
+        timer.beginFrame(f, record);
+
+        auto frameStart = std::chrono::high_resolution_clock::now();
+        renderScene(shaders, renderer, view, outputFramebuffer, 0, 0, &timer);
+        auto frameEnd = std::chrono::high_resolution_clock::now();
+
+        pickImportedObject(cameraPos, cameraFront);
+        auto pickEnd = std::chrono::high_resolution_clock::now();
+
+        record.cpuMs = std::chrono::duration<double, std::milli>(frameEnd - frameStart).count();
+        record.pickMs = std::chrono::duration<double, std::milli>(pickEnd - frameEnd).count();
+        record.drawCalls = frameStats.drawCalls;
+        record.triangles = frameStats.triangles;
+        record.visibleObjects = visibleObjectCount;
+        glFlush();
+    }
+
+    glFinish();
+    timer.resolve(frames);
+    writeBenchmarkReport(options.outputPath, frames);
+
+    std::vector<double> cpuTimes, gpuTimes;
+    for (const auto& frame : frames) {
+        double gpuMs = 0.0;
+        for (int pass = 0; pass < PASS_COUNT; ++pass) gpuMs += frame.gpuPassMs[pass];
+        cpuTimes.push_back(frame.cpuMs);
+        gpuTimes.push_back(gpuMs);
+    }
+    auto summarize = [](const char* label, std::vector<double> times) {
+        std::sort(times.begin(), times.end());
+        double total = 0.0;
+        for (double t : times) total += t;
+        std::cout << label << " ms: avg " << total / times.size() << ", min " << times.front()
+            << ", p95 " << times[times.size() * 95 / 100] << ", max " << times.back() << std::endl;
+    };
+    std::cout << "Rendered " << frames.size() << " frames of " << sceneObjects.size() << " object(s)" << std::endl;
+    summarize("CPU frame", cpuTimes);
+    summarize("GPU frame", gpuTimes);
+    std::cout << "Wrote " << options.outputPath << std::endl;
+
+    glDeleteFramebuffers(1, &outputFramebuffer);
+    glDeleteTextures(1, &outputTexture);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    LaunchOptions options = parseLaunchOptions(argc, argv);
+    unsigned int hardwareThreads = std::max(2u, std::thread::hardware_concurrency());
+    unsigned int importWorkerThreads = options.importThreads > 0 ? options.importThreads - 1 : hardwareThreads - 1;
+    importSettings.useMeshCache = options.useMeshCache;
+
+    if (!options.streamBuildPaths.empty()) {
+        importWorkers.start(importWorkerThreads);
+        bool built = true;
+        for (const std::string& path : options.streamBuildPaths) built = buildMeshStream(path, path + MESH_STREAM_EXTENSION) && built;
+        importWorkers.stop();
+        return built ? 0 : 1;
+    }
+
+    GLFWwindow* window = initGLFW(options.headless);
+    if (!window) return -1;
+
+    if (!options.headless) {
+        IMGUI_CHECKVERSION();
+        ImGui::CreateContext();
+        ImGui_ImplGlfw_InitForOpenGL(window, true);
+        ImGui_ImplOpenGL3_Init("#version 330");
+
+        glfwSetMouseButtonCallback(window, mouseButtonCallback);
+        glfwSetScrollCallback(window, scrollCallback);
+    }
+
+    // Falls back to the GL 3.3 path if the culling shader does not build on this driver
+    if (gpuDrivenSupported && !gpuDrivenRenderer.setup()) gpuDrivenSupported = false;
+    gpuDrivenEnabled = options.gpuDriven && gpuDrivenSupported;
+
+    SceneShaders shaders = createSceneShaders();
+    setupUniformBuffers();
+    setupLightClusters();
+    if (!setupSceneFramebuffer(VIEWPORT_WIDTH, VIEWPORT_HEIGHT)) return -1;
+    idBufferPicker.setup();
+
+    if (!shadowAtlas.setup()) return -1;
+
+    setupLightCube();
+    occlusionCuller.setup();
+    chunkStreamer.setup();
+    fragmentCounter.setup();
+    frameProfiler.setup();
 
     glEnable(GL_DEPTH_TEST);
     glClearColor(0.25f, 0.25f, 0.25f, 1.0f);
 
-    glEnable(GL_STENCIL_TEST);
-    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-
     projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 1000.0f);
 
     Renderer renderer;
 
+    importQueue.start(std::min(4u, hardwareThreads - 1));
+    importWorkers.start(importWorkerThreads);
+    frameWorkers.start(hardwareThreads - 1);
+
+    if (options.headless) {
+        int result = runBenchmark(options, shaders, renderer);
+        importQueue.stop();
+        importWorkers.stop();
+        frameWorkers.stop();
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return result;
+    }
+
+    const int uploadScope = frameProfiler.scope("uploads", false);
+    const int uiScope = frameProfiler.scope("ui", false);
+    const int pickScope = frameProfiler.scope("pick readback", false);
+    const int imguiScope = frameProfiler.scope("imgui", true);
+    const int presentScope = frameProfiler.scope("present", false);
+    if (!options.tracePath.empty()) frameProfiler.startRecording();
+
     while (!glfwWindowShouldClose(window)) {
+        frameProfiler.setEnabled(profilerVisible);
+        frameProfiler.beginFrame();
         glfwPollEvents();
 
+        frameProfiler.beginScope(uploadScope);
+        processImportUploads(IMPORT_UPLOAD_BUDGET_BYTES_PER_FRAME);
+        releaseUnusedModels();
+        meshBufferPool.defragment(MESH_POOL_DEFRAG_BYTES_PER_FRAME);
+        frameProfiler.endScope(uploadScope);
+
+        frameProfiler.beginScope(uiScope);
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
 
         renderSelectedObjectPanel();
         renderObjectListPanel();
+        if (profilerVisible) frameProfiler.renderOverlay(&profilerVisible);
 
         if (!ImGui::GetIO().WantCaptureMouse) {
             processInput(window);
         }
 
-        glm::mat4 view = glm::lookAt(cameraPos, cameraTarget, cameraUp);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-        glViewport(OBJECT_PROPERTIES_PANEL_WIDTH, 0, VIEWPORT_WIDTH, VIEWPORT_HEIGHT);
-
-        glUseProgram(gridShader);
-        renderGrid(gridShader, view, projection);
-
-        if (selectedObject.isSelected() && selectedObject.type == SelectedObject::IMPORTED_OBJECT) {
-            const auto& obj = importedObjects[selectedObject.index];
-
-            glEnable(GL_STENCIL_TEST);
-            glStencilFunc(GL_ALWAYS, 1, 0xFF);
-            glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-            glStencilMask(0xFF);
-            glClear(GL_STENCIL_BUFFER_BIT);
-
-            renderer.render({ obj }, cubeShader, view, projection);
-
-            renderOutline(obj, outlineShader, view, projection);
+        renderMarquee(window);
+        frameProfiler.endScope(uiScope);
 
-            glDisable(GL_STENCIL_TEST);
-        }
-
-        renderLightCube(lightCubeShader, view, projection);
+        frameProfiler.beginScope(pickScope);
+        idBufferPicker.poll();
+        frameProfiler.endScope(pickScope);
 
-        glUseProgram(cubeShader);
-		renderObjects(cubeShader, view, projection);
+        glm::mat4 view = glm::lookAt(cameraPos, cameraTarget, cameraUp);
+        glClear(GL_COLOR_BUFFER_BIT);
 
-        if (selectedObject.isSelected() && selectedObject.type == SelectedObject::IMPORTED_OBJECT) {
-            const auto& obj = importedObjects[selectedObject.index];
-            renderOutline(obj, outlineShader, view, projection);
-        }
+        renderScene(shaders, renderer, view, 0, OBJECT_PROPERTIES_PANEL_WIDTH, 0, &frameProfiler);
 
+        frameProfiler.beginScope(imguiScope);
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        frameProfiler.endScope(imguiScope);
+
+        frameProfiler.beginScope(presentScope);
         glfwSwapBuffers(window);
+        frameProfiler.endScope(presentScope);
+        frameProfiler.endFrame();
     }
 
+    if (!options.tracePath.empty()) frameProfiler.writeTrace(options.tracePath);
+
+    for (auto& job : importJobs) job->cancelRequested = true;
+    importQueue.stop();
+    importWorkers.stop();
+    frameWorkers.stop();
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
     glfwDestroyWindow(window);
     glfwTerminate();
     return 0;
-}
\ No newline at end of file
+}